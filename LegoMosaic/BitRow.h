@@ -0,0 +1,90 @@
+/***
+
+ LegoBitmap - Converts BMP into a Lego Mosaic
+ Copyright (c) 2014 Jeremy Bridon
+
+ Description: Helpers for rows of pegs packed as bits into
+ 64-bit words (bit x of a row is bit x % 64 of word x / 64).
+ Used for board occupancy and per-color masks, so a brick
+ placement test is a handful of word operations per row.
+
+***/
+
+#ifndef __BITROW_H__
+#define __BITROW_H__
+#pragma once
+
+#include <stdint.h>
+
+#ifdef _MSC_VER
+    #include <intrin.h>
+#endif
+
+// Number of words needed to hold a row of the given width
+inline int BitRowWordCount( int width )
+{
+    return ( width + 63 ) / 64;
+}
+
+inline bool BitRowGet( const uint64_t* row, int x )
+{
+    return ( ( row[ x >> 6 ] >> ( x & 63 ) ) & 1 ) != 0;
+}
+
+// Mask of the lowest count bits; count must be in [1, 64]
+inline uint64_t BitRowMask( int count )
+{
+    return ( count >= 64 ) ? ~uint64_t( 0 ) : ( ( uint64_t( 1 ) << count ) - 1 );
+}
+
+// Returns bits [x, x + count) shifted down to bit 0; count must be in [1, 64] and the span inside the row
+inline uint64_t BitRowExtract( const uint64_t* row, int x, int count )
+{
+    int word = x >> 6;
+    int bit = x & 63;
+
+    uint64_t bits = row[ word ] >> bit;
+    if( bit + count > 64 )
+    {
+        bits |= row[ word + 1 ] << ( 64 - bit );
+    }
+    return bits & BitRowMask( count );
+}
+
+// Index of the lowest set bit; the word must not be zero
+inline int BitRowLowestBit( uint64_t word )
+{
+#ifdef _MSC_VER
+    unsigned long index = 0;
+    _BitScanForward64( &index, word );
+    return (int)index;
+#else
+    return __builtin_ctzll( word );
+#endif
+}
+
+// Sets (or clears) bits [x, x + count); any count, the span must be inside the row
+inline void BitRowFill( uint64_t* row, int x, int count, bool value )
+{
+    while( count > 0 )
+    {
+        int word = x >> 6;
+        int bit = x & 63;
+        int span = ( 64 - bit < count ) ? ( 64 - bit ) : count;
+
+        uint64_t mask = BitRowMask( span ) << bit;
+        if( value )
+        {
+            row[ word ] |= mask;
+        }
+        else
+        {
+            row[ word ] &= ~mask;
+        }
+
+        x += span;
+        count -= span;
+    }
+}
+
+#endif // __BITROW_H__
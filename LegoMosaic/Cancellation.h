@@ -0,0 +1,62 @@
+/***
+
+ LegoBitmap - Converts BMP into a Lego Mosaic
+ Copyright (c) 2014 Jeremy Bridon
+
+ Description: Cooperative cancellation for the search engines.
+ A token is cancelled either explicitly, from any thread, or
+ once its deadline passes; engines poll it between steps and
+ wind down with the best set they have, so a solve can be
+ bounded in wall time without stopping the process.
+
+***/
+
+#ifndef __CANCELLATION_H__
+#define __CANCELLATION_H__
+#pragma once
+
+#include <atomic>
+#include <chrono>
+
+class CancellationToken
+{
+public:
+
+    CancellationToken()
+        : m_cancelled( false )
+        , m_hasDeadline( false )
+    {
+    }
+
+    // Safe to call from any thread, at any time
+    void Cancel()
+    {
+        m_cancelled = true;
+    }
+
+    // Cancels the token this many seconds from now; set before handing the token to a solve
+    void SetTimeLimit( double seconds )
+    {
+        m_deadline = std::chrono::steady_clock::now() + std::chrono::duration_cast< std::chrono::steady_clock::duration >( std::chrono::duration< double >( seconds ) );
+        m_hasDeadline = true;
+    }
+
+    // Once true, stays true
+    bool IsCancelled() const
+    {
+        if( !m_cancelled && m_hasDeadline && std::chrono::steady_clock::now() >= m_deadline )
+        {
+            m_cancelled = true;
+        }
+        return m_cancelled;
+    }
+
+private:
+
+    mutable std::atomic< bool > m_cancelled;
+    bool m_hasDeadline;
+    std::chrono::steady_clock::time_point m_deadline;
+
+};
+
+#endif // __CANCELLATION_H__
@@ -28,6 +28,8 @@ namespace
 
 LegoBitmap::LegoBitmap( const char* fileName )
     : m_boardSize( 0, 0 )
+    , m_rowWordCount( 0 )
+    , m_colorCount( 0 )
     , m_validPegs( 0 )
 {
     unsigned int width;
@@ -41,6 +43,7 @@ LegoBitmap::LegoBitmap( const char* fileName )
     }
     
     m_boardSize = Vec2( width, height );
+    m_rowWordCount = BitRowWordCount( width );
     
     // Convert to packed-buffer array
     for( int i = 0; i < pngBuffer.size(); i += 4 )
@@ -61,9 +64,44 @@ LegoBitmap::LegoBitmap( const LegoBitmap& legoBitmap )
     m_boardSize = legoBitmap.m_boardSize;
     m_pngBuffer = legoBitmap.m_pngBuffer;
     m_colorIndices = legoBitmap.m_colorIndices;
+    m_colorPlanes = legoBitmap.m_colorPlanes;
+    m_coloredPlane = legoBitmap.m_coloredPlane;
+    m_rowWordCount = legoBitmap.m_rowWordCount;
+    m_colorCount = legoBitmap.m_colorCount;
     m_validPegs = legoBitmap.m_validPegs;
 }
 
+LegoBitmap::LegoBitmap( const LegoBitmap& legoBitmap, const Vec2& origin, const Vec2& size, const std::vector< int >& regionIds, int regionId )
+    : m_boardSize( size )
+    , m_rowWordCount( BitRowWordCount( size.x ) )
+    , m_colorCount( legoBitmap.m_colorCount )
+    , m_validPegs( 0 )
+{
+    m_pngBuffer.resize( size.x * size.y, 0x00000000 );
+    m_colorIndices.resize( size.x * size.y, -1 );
+    m_colorPlanes.assign( m_colorCount * size.y * m_rowWordCount, 0 );
+    m_coloredPlane.assign( size.y * m_rowWordCount, 0 );
+    
+    IterateBoard( [&](Vec2 pos)
+        {
+            int srcIndex = ( origin.y + pos.y ) * legoBitmap.m_boardSize.x + ( origin.x + pos.x );
+            if( regionIds[ srcIndex ] != regionId )
+            {
+                return;
+            }
+            
+            int pegIndex = pos.y * m_boardSize.x + pos.x;
+            int colorIndex = legoBitmap.m_colorIndices[ srcIndex ];
+            m_pngBuffer[ pegIndex ] = legoBitmap.m_pngBuffer[ srcIndex ];
+            m_colorIndices[ pegIndex ] = colorIndex;
+            m_validPegs++;
+            
+            BitRowFill( &m_colorPlanes[ ( colorIndex * m_boardSize.y + pos.y ) * m_rowWordCount ], pos.x, 1, true );
+            BitRowFill( &m_coloredPlane[ pos.y * m_rowWordCount ], pos.x, 1, true );
+        }
+    );
+}
+
 LegoBitmap::~LegoBitmap()
 {
 	// ...
@@ -76,9 +114,20 @@ bool LegoBitmap::ConvertMosaic( const BrickColorList& brickColorList, bool dithe
         return false;
     }
     
+    // LegoSet's run tables can't describe longer runs
+    if( m_boardSize.x > LegoSet::cMaxBoardSide || m_boardSize.y > LegoSet::cMaxBoardSide )
+    {
+        return false;
+    }
+    
     // Allocate the board-colors map; defaults buffer values to -1 (no color)
     m_colorIndices.resize( m_boardSize.x * m_boardSize.y );
     
+    // And the per-color bit-planes, all clear
+    m_colorCount = (int)brickColorList.size();
+    m_colorPlanes.assign( m_colorCount * m_boardSize.y * m_rowWordCount, 0 );
+    m_coloredPlane.assign( m_boardSize.y * m_rowWordCount, 0 );
+    
 	// For each pixel, color-match
 	IterateBoard( [&](Vec2 pos)
         {
@@ -104,6 +153,13 @@ bool LegoBitmap::ConvertMosaic( const BrickColorList& brickColorList, bool dithe
             // Save to internal buffer if non-zero
             int pegIndex = pos.y * m_boardSize.x + pos.x;
             m_colorIndices[ pegIndex ] = bestColorIndex;
+            
+            if( bestColorIndex >= 0 )
+            {
+                uint64_t* colorRow = &m_colorPlanes[ ( bestColorIndex * m_boardSize.y + pos.y ) * m_rowWordCount ];
+                BitRowFill( colorRow, pos.x, 1, true );
+                BitRowFill( &m_coloredPlane[ pos.y * m_rowWordCount ], pos.x, 1, true );
+            }
         }
     );
     
@@ -138,6 +194,64 @@ int LegoBitmap::GetBrickColorIndex( const Vec2& pegPos ) const
     };
 }
 
+const uint64_t* LegoBitmap::GetColorRow( int colorIndex, int y ) const
+{
+    if( colorIndex < 0 || colorIndex >= m_colorCount || y < 0 || y >= m_boardSize.y )
+    {
+        return NULL;
+    }
+    
+    return &m_colorPlanes[ ( colorIndex * m_boardSize.y + y ) * m_rowWordCount ];
+}
+
+int LegoBitmap::LabelRegions( std::vector< int >& regionIdsOut ) const
+{
+    regionIdsOut.assign( m_colorIndices.size(), -1 );
+    
+    // Flood fill from each unlabeled peg; explicit stack, since regions can be as large as the board
+    int regionCount = 0;
+    std::vector< int > pegStack;
+    for( int startIndex = 0; startIndex < (int)m_colorIndices.size(); startIndex++ )
+    {
+        int colorIndex = m_colorIndices[ startIndex ];
+        if( colorIndex < 0 || regionIdsOut[ startIndex ] >= 0 )
+        {
+            continue;
+        }
+        
+        regionIdsOut[ startIndex ] = regionCount;
+        pegStack.push_back( startIndex );
+        while( !pegStack.empty() )
+        {
+            int pegIndex = pegStack.back();
+            pegStack.pop_back();
+            
+            int x = pegIndex % m_boardSize.x;
+            int y = pegIndex / m_boardSize.x;
+            int neighbors[ 4 ] = {
+                ( x > 0 ) ? pegIndex - 1 : -1,
+                ( x < m_boardSize.x - 1 ) ? pegIndex + 1 : -1,
+                ( y > 0 ) ? pegIndex - m_boardSize.x : -1,
+                ( y < m_boardSize.y - 1 ) ? pegIndex + m_boardSize.x : -1,
+            };
+            
+            for( int i = 0; i < 4; i++ )
+            {
+                int neighborIndex = neighbors[ i ];
+                if( neighborIndex >= 0 && regionIdsOut[ neighborIndex ] < 0 && m_colorIndices[ neighborIndex ] == colorIndex )
+                {
+                    regionIdsOut[ neighborIndex ] = regionCount;
+                    pegStack.push_back( neighborIndex );
+                }
+            }
+        }
+        
+        regionCount++;
+    }
+    
+    return regionCount;
+}
+
 void LegoBitmap::SavePng( const char* fileName, const BrickColorList& brickColorList ) const
 {
     // Pack as RGBA buffer
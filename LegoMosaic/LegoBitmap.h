@@ -27,6 +27,7 @@
 #include <algorithm>
 
 #include "LegoSet.h"
+#include "BitRow.h"
 
 // A color is just a simple hex
 typedef uint32_t BrickColor;
@@ -40,17 +41,32 @@ public:
 	// Define a set of lego pieces and image file-name you're trying to mosaic-solve
 	LegoBitmap( const char* fileName );
     LegoBitmap( const LegoBitmap& legoBitmap );
+    
+    // Sub-board of a converted bitmap: the given rectangle, keeping only the pegs labeled with the given region (see LabelRegions(...))
+    // Everything else becomes empty (no color), so a set on it only has to cover that one region
+    LegoBitmap( const LegoBitmap& legoBitmap, const Vec2& origin, const Vec2& size, const std::vector< int >& regionIds, int regionId );
 	~LegoBitmap();
     
     const Vec2& GetBoardSize() const { return m_boardSize; }
     
-    // Converts pixel buffer to best-matched mosaic colors; return false on failure (no image loaded, no colors, etc.)
+    // Converts pixel buffer to best-matched mosaic colors; return false on failure (no image loaded, board wider or taller than LegoSet::cMaxBoardSide, etc.)
     bool ConvertMosaic( const BrickColorList& brickColorList, bool dither = false );
     
     // Get the brick color index at the given; returns -1 on alpha or when not yet converted to mosaic
     const BrickColor& GetBrickColor( const Vec2& pegPos ) const;
     int GetBrickColorIndex( const Vec2& pegPos ) const;
     
+    // Bit row (see BitRow.h) of the pegs with the given color; NULL on a bad color index or when not yet converted
+    const uint64_t* GetColorRow( int colorIndex, int y ) const;
+    int GetRowWordCount() const { return m_rowWordCount; }
+    
+    // Bit row of every peg that has a color, whichever it is
+    const uint64_t* GetColoredRow( int y ) const { return &m_coloredPlane[ y * m_rowWordCount ]; }
+    
+    // Labels each 4-connected, same-color group of pegs with a region index, in scan order of their first peg
+    // Empty pegs are labeled -1; returns the number of regions. No brick can span two regions, so each one can be solved on its own
+    int LabelRegions( std::vector< int >& regionIdsOut ) const;
+    
     // Save current image *.png to file; can draw in special format for debugging
     void SavePng( const char* fileName, const BrickColorList& brickColorList ) const;
 	void SavePng( const char* fileName, const BrickDefinitionList& brickDefinitions, const BrickColorList& brickColors, const LegoSet& legoSet, int tileSize = 5 ) const;
@@ -84,6 +100,12 @@ private:
     std::vector< BrickColor > m_pngBuffer;
     std::vector< int > m_colorIndices;
     
+    // One bit-plane per brick color, parallel to m_colorIndices: m_colorPlanes[ ( colorIndex * height + y ) * m_rowWordCount + word ]
+    std::vector< uint64_t > m_colorPlanes;
+    std::vector< uint64_t > m_coloredPlane;
+    int m_rowWordCount;
+    int m_colorCount;
+    
     // Number of valid pegs; only valid after mosaic conversion function call
     int m_validPegs;
     
@@ -6,10 +6,40 @@
 ***/
 
 #include "LegoMosaic.h"
+#include "Zobrist.h"
 
-#include <deque>
+#include <atomic>
+#include <queue>
+#include <unordered_set>
+#include <memory>
+#include <random>
 #include <thread>
+#include <climits>
+#include <cmath>
 #include <cstdlib>
+#include <stdio.h>
+#include <string.h>
+
+namespace
+{
+    // Aim for a few tasks per worker, so work stealing has something to balance
+    const int cTasksPerWorker = 4;
+    
+    // Below this many (position, definition) pairs, candidates are evaluated inline
+    const int cMinParallelCandidates = 64;
+    
+    // Upper bound on states remembered by exact searches (16 bytes each); tables start small and grow to this
+    const size_t cTranspositionTableEntries = size_t( 1 ) << 22;
+    
+    // Exact searches poll their cancellation token once per this many nodes
+    const uint64_t cCancellationCheckNodes = 1024;
+    
+    // Improvement rounds given to the portfolio entries that use them
+    const int cPortfolioImproveRounds = 10;
+    
+    // Smallest blocks the coarse pass places (2^level pegs on a side); below this greedy does better
+    const int cCoarseMinLevel = 2;
+}
 
 int BrickDefinitionCompare( const void* b0, const void* b1 )
 {
@@ -21,290 +51,2254 @@ int BrickDefinitionCompare( const void* b0, const void* b1 )
 LegoMosaic::LegoMosaic( const BrickDefinitionList& brickDefinitions, const BrickColorList& brickColors )
     : m_brickDefinitions( brickDefinitions )
     , m_brickColors( brickColors )
+    , m_bestCostPerPeg( 0.0f )
     , m_solutionSet( NULL )
+    , m_threadPool( NULL )
+    , m_tilingTable( NULL )
 {
     // Duplicate the entire array to suppoert flipped orientation
     int count = (int)m_brickDefinitions.size();
     for( int i = 0; i < count; i++ )
     {
-        // Any non-uniform shape def..
-        const BrickDefinition& brickDef = m_brickDefinitions.at( i );
-        if( brickDef.m_shape.x != brickDef.m_shape.y )
+        // Any non-uniform shape def..
+        const BrickDefinition& brickDef = m_brickDefinitions.at( i );
+        if( brickDef.m_shape.x != brickDef.m_shape.y )
+        {
+            BrickDefinition newDef( brickDef );
+            newDef.m_definitionId = (int)m_brickDefinitions.size();
+            newDef.m_shape = Vec2( newDef.m_shape.y, newDef.m_shape.x );
+            
+            m_brickDefinitions.push_back( newDef );
+        }
+    }
+    
+    // Index definitions by shape (width, then height), so candidate loops can skip shapes that can't fit
+    for( int i = 0; i < (int)m_brickDefinitions.size(); i++ )
+    {
+        m_shapeIndex.push_back( i );
+    }
+    std::stable_sort( m_shapeIndex.begin(), m_shapeIndex.end(), [&]( int a, int b )
+        {
+            const Vec2& shapeA = m_brickDefinitions[ a ].m_shape;
+            const Vec2& shapeB = m_brickDefinitions[ b ].m_shape;
+            return ( shapeA.x < shapeB.x ) || ( shapeA.x == shapeB.x && shapeA.y < shapeB.y );
+        }
+    );
+    
+    m_shapeIndexNextWidth.resize( m_shapeIndex.size() );
+    for( int i = (int)m_shapeIndex.size() - 1; i >= 0; i-- )
+    {
+        bool lastOfWidth = ( i == (int)m_shapeIndex.size() - 1 ) || ( m_brickDefinitions[ m_shapeIndex[ i + 1 ] ].m_shape.x != m_brickDefinitions[ m_shapeIndex[ i ] ].m_shape.x );
+        m_shapeIndexNextWidth[ i ] = lastOfWidth ? i + 1 : m_shapeIndexNextWidth[ i + 1 ];
+    }
+    
+    for( int i = 0; i < (int)m_brickDefinitions.size(); i++ )
+    {
+        const BrickDefinition& brickDef = m_brickDefinitions[ i ];
+        float costPerPeg = float( brickDef.m_cost ) / float( brickDef.m_shape.x * brickDef.m_shape.y );
+        if( i == 0 || costPerPeg < m_bestCostPerPeg )
+        {
+            m_bestCostPerPeg = costPerPeg;
+        }
+    }
+    
+    // Note that we should sort our bricks to be based on relative peg / cost unit
+    // I'm aware qsort is *not* to be mixed with C++, but std::swap requires tons of overhead code for not much gain
+    std::qsort( (void*)&brickDefinitions[0], brickDefinitions.size(), sizeof( BrickDefinition ), BrickDefinitionCompare );
+    
+    m_tilingTable = new TilingTable( m_brickDefinitions );
+}
+
+LegoMosaic::~LegoMosaic()
+{
+    delete m_solutionSet;
+    delete m_threadPool;
+    delete m_tilingTable;
+}
+
+bool LegoMosaic::Solve( const char* fileName, const SolverSettings& givenSettings )
+{
+    // Every engine polls the same token; the clock starts now, so loading and converting count against the limit
+    SolverSettings settings = givenSettings;
+    if( !settings.m_cancellation )
+    {
+        settings.m_cancellation = std::make_shared< CancellationToken >();
+    }
+    if( settings.m_timeLimit > 0.0 )
+    {
+        settings.m_cancellation->SetTimeLimit( settings.m_timeLimit );
+    }
+    
+    {
+        std::lock_guard< std::mutex > lock( m_publishMutex );
+        m_publishedSet.reset();
+    }
+    
+    // 1. Load the image
+    m_portfolioWinner.clear();
+    
+    std::string tilingFileName;
+    if( !settings.m_tilingCacheDirectory.empty() )
+    {
+        tilingFileName = m_tilingTable->GetFileName( settings.m_tilingCacheDirectory.c_str() );
+        if( m_tilingTable->Load( tilingFileName.c_str() ) && settings.m_printProgress )
+        {
+            printf( "Loaded %d rectangle tilings from \"%s\"\n", m_tilingTable->GetEntryCount(), tilingFileName.c_str() );
+        }
+    }
+    
+    std::shared_ptr< LegoBitmap > loadedBitmap = std::make_shared< LegoBitmap >( fileName );
+    if( loadedBitmap->ConvertMosaic( m_brickColors, settings.m_dither ) == false )
+    {
+        printf( "Unable to convert the given file \"%s\" to the given Lego colors (boards are at most %d pegs on a side)\n", fileName ? fileName : NULL, LegoSet::cMaxBoardSide );
+        return false;
+    }
+    
+    // From here on the bitmap is read-only; worker tasks share this one instance instead of copying it
+    std::shared_ptr< const LegoBitmap > bitmapView = loadedBitmap;
+    const LegoBitmap& legoBitmap = *bitmapView;
+    legoBitmap.SavePng( "LegoMosaicProgress_Output.png", m_brickColors );
+    
+    m_boardSize = legoBitmap.GetBoardSize();
+    
+    // Pool lives as long as we do; only rebuilt if the threading choice changed
+    int workerCount = settings.m_useThreading ? std::max( 1, (int)std::thread::hardware_concurrency() ) : 1;
+    if( m_threadPool == NULL || m_threadPool->GetWorkerCount() != workerCount )
+    {
+        delete m_threadPool;
+        m_threadPool = new ThreadPool( workerCount );
+    }
+    
+    BrickList brickList;
+    delete m_solutionSet;
+    m_solutionSet = new LegoSet( legoBitmap, brickList, m_brickDefinitions );
+    
+    // 2. Run the chosen search engine, starting from an empty set
+    LegoSet legoSet( legoBitmap, brickList, m_brickDefinitions );
+    bool solved = false;
+    if( settings.m_usePortfolio )
+    {
+        solved = SolvePortfolio( bitmapView, legoSet, settings );
+    }
+    else
+    {
+        solved = settings.m_useRegions ? SolveRegions( bitmapView, legoSet, settings ) : RunSolver( bitmapView, legoSet, settings );
+    }
+    
+    // Stopped early: take the cheapest complete set any engine published, else finish the partial one quickly
+    if( !solved && settings.m_cancellation->IsCancelled() )
+    {
+        if( settings.m_printProgress )
+        {
+            printf( "Time limit reached (or solve cancelled); returning the best set found so far\n" );
+        }
+        
+        if( !GetBestSolution( legoSet ) || !legoSet.IsSolved() )
+        {
+            solved = FillUncovered( legoBitmap, legoSet );
+        }
+        else
+        {
+            solved = true;
+        }
+    }
+    
+    if( !solved )
+    {
+        printf( "Critical error: unable to place a brick into an unsolved set\n" );
+        return false;
+    }
+    
+    if( settings.m_improveRounds > 0 )
+    {
+        int savedCost = ImproveSolution( bitmapView, legoSet, settings );
+        if( settings.m_printProgress )
+        {
+            printf( "Improved the solution by $%d.%02d in %d rounds\n", savedCost / 100, savedCost % 100, settings.m_improveRounds );
+        }
+    }
+    
+    if( settings.m_mergeBricks )
+    {
+        int brickCount = (int)legoSet.GetBrickList().size();
+        int savedCost = MergeBricks( legoBitmap, legoSet );
+        if( settings.m_printProgress )
+        {
+            printf( "Merged %d bricks into larger ones, saving $%d.%02d\n", brickCount - (int)legoSet.GetBrickList().size(), savedCost / 100, savedCost % 100 );
+        }
+    }
+    
+    *m_solutionSet = legoSet;
+    PublishSolution( legoSet, settings );
+    
+    if( !tilingFileName.empty() && !m_tilingTable->Save( tilingFileName.c_str() ) )
+    {
+        printf( "Unable to save the rectangle tilings to \"%s\"\n", tilingFileName.c_str() );
+    }
+    
+    // Write out solution
+    if( m_solutionSet != NULL )
+    {
+        legoBitmap.SavePng( "LegoMosaicProgress_Result.png", m_brickDefinitions, m_brickColors, *m_solutionSet );
+    }
+    
+    // 3. Print parts list, with price; deffers to PrintSolution(...)
+    return true;
+}
+
+bool LegoMosaic::GetBestSolution( LegoSet& legoSetOut )
+{
+    std::shared_ptr< LegoSet > publishedSet;
+    {
+        std::lock_guard< std::mutex > lock( m_publishMutex );
+        publishedSet = m_publishedSet;
+    }
+    
+    // Published sets are never changed once they are out, so the copy can happen outside the lock
+    if( !publishedSet )
+    {
+        return false;
+    }
+    legoSetOut = *publishedSet;
+    return true;
+}
+
+void LegoMosaic::PublishSolution( const LegoSet& legoSet, const SolverSettings& settings )
+{
+    if( !settings.m_publishSolutions || !legoSet.IsSolved() )
+    {
+        return;
+    }
+    
+    std::shared_ptr< LegoSet > publishedSet = std::make_shared< LegoSet >( legoSet );
+    std::lock_guard< std::mutex > lock( m_publishMutex );
+    if( !m_publishedSet || legoSet.GetCost() < m_publishedSet->GetCost() )
+    {
+        m_publishedSet = publishedSet;
+    }
+}
+
+bool LegoMosaic::IsCancelled( const SolverSettings& settings ) const
+{
+    return settings.m_cancellation && settings.m_cancellation->IsCancelled();
+}
+
+bool LegoMosaic::IsCancelled( ExactSearch& search, const SolverSettings& settings ) const
+{
+    if( !search.m_cancelled && ( search.m_nodeCount % cCancellationCheckNodes ) == 0 )
+    {
+        search.m_cancelled = IsCancelled( settings );
+    }
+    return search.m_cancelled;
+}
+
+bool LegoMosaic::FillUncovered( const LegoBitmap& legoBitmap, LegoSet& legoSetInOut ) const
+{
+    // Everything before the first uncovered peg is covered, so a brick anchored on it never overlaps; a 1x1 always fits
+    BrickList placements;
+    Vec2 startPeg( 0, 0 );
+    Vec2 peg;
+    while( legoSetInOut.GetFirstUncoveredPeg( legoBitmap, startPeg, peg ) )
+    {
+        startPeg = peg;
+        GetCanonicalPlacements( legoBitmap, legoSetInOut, peg, placements );
+        if( placements.empty() || !legoSetInOut.AddBrick( placements[ 0 ], m_brickDefinitions, legoBitmap ) )
+        {
+            return false;
+        }
+    }
+    return legoSetInOut.IsSolved();
+}
+
+int LegoMosaic::MergeBricks( const LegoBitmap& legoBitmap, LegoSet& legoSetInOut ) const
+{
+    const Vec2& boardSize = legoBitmap.GetBoardSize();
+    BrickList bricks = legoSetInOut.GetBrickList();
+    std::vector< char > removed( bricks.size(), 0 );
+    
+    // Spatial index: which brick covers each peg, or -1
+    std::vector< int > pegBricks( boardSize.x * boardSize.y, -1 );
+    auto indexBrick = [&]( int brickIndex, int value )
+    {
+        const Brick& brick = bricks[ brickIndex ];
+        const Vec2& shape = m_brickDefinitions[ brick.m_definitionId ].m_shape;
+        for( int y = brick.m_position.y; y < brick.m_position.y + shape.y; y++ )
+        {
+            for( int x = brick.m_position.x; x < brick.m_position.x + shape.x; x++ )
+            {
+                pegBricks[ y * boardSize.x + x ] = value;
+            }
+        }
+    };
+    for( int i = 0; i < (int)bricks.size(); i++ )
+    {
+        indexBrick( i, i );
+    }
+    
+    // Cost of the bricks that exactly tile the given rectangle in one color, or -1 if they don't
+    // Only bricks anchored on a peg are counted, so each one is counted once
+    auto getTiledCost = [&]( const Vec2& origin, const Vec2& size, int colorId )
+    {
+        if( origin.x + size.x > boardSize.x || origin.y + size.y > boardSize.y )
+        {
+            return -1;
+        }
+        
+        int tiledCost = 0;
+        for( int y = origin.y; y < origin.y + size.y; y++ )
+        {
+            for( int x = origin.x; x < origin.x + size.x; x++ )
+            {
+                int brickIndex = pegBricks[ y * boardSize.x + x ];
+                if( brickIndex < 0 )
+                {
+                    return -1;
+                }
+                
+                const Brick& brick = bricks[ brickIndex ];
+                const Vec2& shape = m_brickDefinitions[ brick.m_definitionId ].m_shape;
+                if( brick.m_colorId != colorId || brick.m_position.x < origin.x || brick.m_position.y < origin.y ||
+                    brick.m_position.x + shape.x > origin.x + size.x || brick.m_position.y + shape.y > origin.y + size.y )
+                {
+                    return -1;
+                }
+                else if( brick.m_position.x == x && brick.m_position.y == y )
+                {
+                    tiledCost += m_brickDefinitions[ brick.m_definitionId ].m_cost;
+                }
+            }
+        }
+        return tiledCost;
+    };
+    
+    // Every group's top-left brick shares the group's top-left corner, so each brick only has to be tried as that corner,
+    // once per definition; merged bricks are appended, and tried again later in the same pass
+    int savedCost = 0;
+    for( bool merged = true; merged; )
+    {
+        merged = false;
+        for( int i = 0; i < (int)bricks.size(); i++ )
+        {
+            if( removed[ i ] )
+            {
+                continue;
+            }
+            
+            const Vec2 origin = bricks[ i ].m_position;
+            const int colorId = bricks[ i ].m_colorId;
+            const Vec2 seedShape = m_brickDefinitions[ bricks[ i ].m_definitionId ].m_shape;
+            
+            int bestDefinition = -1;
+            int bestSaving = 0;
+            for( int defIndex = 0; defIndex < (int)m_brickDefinitions.size(); defIndex++ )
+            {
+                const BrickDefinition& brickDef = m_brickDefinitions[ defIndex ];
+                if( brickDef.m_shape.x < seedShape.x || brickDef.m_shape.y < seedShape.y )
+                {
+                    continue;
+                }
+                
+                int tiledCost = getTiledCost( origin, brickDef.m_shape, colorId );
+                if( tiledCost - brickDef.m_cost > bestSaving )
+                {
+                    bestSaving = tiledCost - brickDef.m_cost;
+                    bestDefinition = defIndex;
+                }
+            }
+            
+            if( bestDefinition < 0 )
+            {
+                continue;
+            }
+            
+            // Take out every brick under the new one, then put it in
+            const Vec2& shape = m_brickDefinitions[ bestDefinition ].m_shape;
+            for( int y = origin.y; y < origin.y + shape.y; y++ )
+            {
+                for( int x = origin.x; x < origin.x + shape.x; x++ )
+                {
+                    removed[ pegBricks[ y * boardSize.x + x ] ] = 1;
+                }
+            }
+            
+            bricks.push_back( Brick( bestDefinition, colorId, origin ) );
+            removed.push_back( 0 );
+            indexBrick( (int)bricks.size() - 1, (int)bricks.size() - 1 );
+            
+            savedCost += bestSaving;
+            merged = true;
+        }
+    }
+    
+    if( savedCost > 0 )
+    {
+        BrickList keptBricks;
+        for( int i = 0; i < (int)bricks.size(); i++ )
+        {
+            if( !removed[ i ] )
+            {
+                keptBricks.push_back( bricks[ i ] );
+            }
+        }
+        legoSetInOut = LegoSet( legoBitmap, keptBricks, m_brickDefinitions );
+    }
+    
+    return savedCost;
+}
+
+int LegoMosaic::ImproveSolution( const std::shared_ptr< const LegoBitmap >& bitmapView, LegoSet& legoSetInOut, const SolverSettings& settings )
+{
+    const LegoBitmap& legoBitmap = *bitmapView;
+    const Vec2& boardSize = legoBitmap.GetBoardSize();
+    const int workerCount = settings.m_useThreading ? m_threadPool->GetWorkerCount() : 1;
+    
+    // A hole never outgrows its window, so the default window is the largest square the exact engine still takes whole
+    int windowSize = settings.m_windowSize;
+    if( windowSize <= 0 )
+    {
+        windowSize = 1;
+        while( ( windowSize + 1 ) * ( windowSize + 1 ) <= settings.m_exactPegLimit )
+        {
+            windowSize++;
+        }
+    }
+    windowSize = std::max( windowSize, 2 );
+    
+    // Holes are small and many, so they are the parallel work; each one is solved inline and quietly
+    SolverSettings holeSettings = settings;
+    holeSettings.m_solverType = SolverType_BranchAndBound;
+    holeSettings.m_useThreading = false;
+    holeSettings.m_printProgress = false;
+    holeSettings.m_saveProgress = false;
+    holeSettings.m_publishSolutions = false;
+    holeSettings.m_coarseToFine = false;
+    
+    // Only the window offsets are random; everything else is in a fixed order, so a seed always gives the same result
+    std::mt19937 random( settings.m_seed );
+    std::vector< int > holeIds( boardSize.x * boardSize.y );
+    int savedCost = 0;
+    
+    for( int round = 0; round < settings.m_improveRounds && !IsCancelled( settings ); round++ )
+    {
+        // Window grid for this round; the first row and column start off the board, so the offset can be anything
+        const Vec2 offset( int( random() % windowSize ), int( random() % windowSize ) );
+        const Vec2 gridSize( ( boardSize.x + offset.x ) / windowSize + 1, ( boardSize.y + offset.y ) / windowSize + 1 );
+        const int windowCount = gridSize.x * gridSize.y;
+        auto getWindow = [&]( const Vec2& pos ) { return ( ( pos.y + offset.y ) / windowSize ) * gridSize.x + ( pos.x + offset.x ) / windowSize; };
+        
+        // Only bricks entirely inside a window are ripped out, so the holes of different windows never touch
+        const BrickList& bricks = legoSetInOut.GetBrickList();
+        std::vector< int > brickWindows( bricks.size(), -1 );
+        std::vector< int > rippedCosts( windowCount, 0 );
+        std::vector< int > rippedCounts( windowCount, 0 );
+        std::fill( holeIds.begin(), holeIds.end(), -1 );
+        
+        for( int i = 0; i < (int)bricks.size(); i++ )
+        {
+            const BrickDefinition& brickDef = m_brickDefinitions[ bricks[ i ].m_definitionId ];
+            Vec2 lastPeg( bricks[ i ].m_position.x + brickDef.m_shape.x - 1, bricks[ i ].m_position.y + brickDef.m_shape.y - 1 );
+            
+            int window = getWindow( bricks[ i ].m_position );
+            if( window == getWindow( lastPeg ) )
+            {
+                brickWindows[ i ] = window;
+                rippedCosts[ window ] += brickDef.m_cost;
+                rippedCounts[ window ]++;
+                for( int y = bricks[ i ].m_position.y; y <= lastPeg.y; y++ )
+                {
+                    for( int x = bricks[ i ].m_position.x; x <= lastPeg.x; x++ )
+                    {
+                        holeIds[ y * boardSize.x + x ] = window;
+                    }
+                }
+            }
+        }
+        
+        // A single brick can't be beaten by a re-solve of its own footprint unless a cheaper one fits it exactly
+        std::vector< int > holeWindows;
+        for( int window = 0; window < windowCount; window++ )
+        {
+            if( rippedCounts[ window ] > 1 )
+            {
+                holeWindows.push_back( window );
+            }
+        }
+        
+        std::vector< BrickList > holeBricks( windowCount );
+        std::vector< char > holeImproved( windowCount, 0 );
+        std::function< void(int, int) > repairFunc = [&]( int taskIndex, int ) {
+            if( IsCancelled( settings ) )
+            {
+                return;
+            }
+            
+            int window = holeWindows[ taskIndex ];
+            Vec2 windowMin( std::max( 0, ( window % gridSize.x ) * windowSize - offset.x ), std::max( 0, ( window / gridSize.x ) * windowSize - offset.y ) );
+            Vec2 windowMax( std::min( boardSize.x, ( window % gridSize.x + 1 ) * windowSize - offset.x ), std::min( boardSize.y, ( window / gridSize.x + 1 ) * windowSize - offset.y ) );
+            Vec2 size( windowMax.x - windowMin.x, windowMax.y - windowMin.y );
+            
+            std::shared_ptr< const LegoBitmap > holeBitmap = std::make_shared< LegoBitmap >( legoBitmap, windowMin, size, holeIds, window );
+            LegoSet holeSet( *holeBitmap, BrickList(), m_brickDefinitions );
+            
+            if( RunSolver( holeBitmap, holeSet, holeSettings ) && holeSet.GetCost() < rippedCosts[ window ] )
+            {
+                // Back to board coordinates
+                holeBricks[ window ] = holeSet.GetBrickList();
+                for( int i = 0; i < (int)holeBricks[ window ].size(); i++ )
+                {
+                    holeBricks[ window ][ i ].m_position = Vec2( holeBricks[ window ][ i ].m_position.x + windowMin.x, holeBricks[ window ][ i ].m_position.y + windowMin.y );
+                }
+                holeImproved[ window ] = 1;
+            }
+        };
+        
+        if( workerCount > 1 )
+        {
+            m_threadPool->ParallelFor( (int)holeWindows.size(), repairFunc );
+        }
+        else
+        {
+            for( int i = 0; i < (int)holeWindows.size(); i++ )
+            {
+                repairFunc( i, 0 );
+            }
+        }
+        
+        // Swap in the cheaper holes, in window order
+        BrickList nextBricks;
+        int roundSavedCost = 0;
+        for( int i = 0; i < (int)bricks.size(); i++ )
+        {
+            if( brickWindows[ i ] < 0 || !holeImproved[ brickWindows[ i ] ] )
+            {
+                nextBricks.push_back( bricks[ i ] );
+            }
+        }
+        for( int window = 0; window < windowCount; window++ )
+        {
+            if( holeImproved[ window ] )
+            {
+                nextBricks.insert( nextBricks.end(), holeBricks[ window ].begin(), holeBricks[ window ].end() );
+                roundSavedCost += rippedCosts[ window ];
+                for( int i = 0; i < (int)holeBricks[ window ].size(); i++ )
+                {
+                    roundSavedCost -= m_brickDefinitions[ holeBricks[ window ][ i ].m_definitionId ].m_cost;
+                }
+            }
+        }
+        
+        if( roundSavedCost > 0 )
+        {
+            legoSetInOut = LegoSet( legoBitmap, nextBricks, m_brickDefinitions );
+            savedCost += roundSavedCost;
+            PublishSolution( legoSetInOut, settings );
+        }
+        
+        if( settings.m_printProgress )
+        {
+            printf( "Improvement round %d: %d holes re-solved, cost %d\n", round + 1, (int)holeWindows.size(), legoSetInOut.GetCost() );
+        }
+    }
+    
+    return savedCost;
+}
+
+bool LegoMosaic::RunSolver( const std::shared_ptr< const LegoBitmap >& bitmapView, LegoSet& legoSetInOut, const SolverSettings& settings )
+{
+    if( settings.m_coarseToFine )
+    {
+        int brickCount = PlaceCoarseBlocks( *bitmapView, legoSetInOut );
+        if( brickCount < 0 )
+        {
+            return false;
+        }
+        if( settings.m_printProgress )
+        {
+            printf( "Coarse pass: %d bricks cover %d of %d pegs\n", brickCount, (int)legoSetInOut.GetPlacedPegCount(), bitmapView->GetMosaicPegCount() );
+        }
+    }
+    
+    switch( settings.m_solverType )
+    {
+        case SolverType_GreedyQueue:
+            return SolveGreedyQueue( *bitmapView, legoSetInOut, settings );
+        case SolverType_BruteForce:
+            return SolveBruteForce( *bitmapView, legoSetInOut, settings );
+        case SolverType_AStar:
+            return SolveAStar( bitmapView, legoSetInOut, settings );
+        case SolverType_Beam:
+            return SolveBeam( bitmapView, legoSetInOut, settings );
+        case SolverType_Scanline:
+            return SolveScanline( *bitmapView, legoSetInOut, settings );
+        case SolverType_MaxRect:
+            return SolveMaxRect( *bitmapView, legoSetInOut, settings );
+        case SolverType_Partition:
+            return SolvePartition( *bitmapView, legoSetInOut, settings );
+        case SolverType_BranchAndBound:
+            if( bitmapView->GetMosaicPegCount() <= settings.m_exactPegLimit )
+            {
+                return SolveBranchAndBound( bitmapView, legoSetInOut, settings );
+            }
+            return SolveGreedy( bitmapView, legoSetInOut, settings );
+        default:
+            return SolveGreedy( bitmapView, legoSetInOut, settings );
+    }
+}
+
+bool LegoMosaic::SolvePortfolio( const std::shared_ptr< const LegoBitmap >& bitmapView, LegoSet& legoSetInOut, const SolverSettings& settings )
+{
+    const LegoBitmap& legoBitmap = *bitmapView;
+    
+    // The configurations raced; each one runs inline and quietly, so the portfolio itself is the parallel work
+    struct PortfolioEntry
+    {
+        std::string m_name;
+        SolverSettings m_settings;
+    };
+    
+    SolverSettings baseSettings = settings;
+    baseSettings.m_usePortfolio = false;
+    baseSettings.m_useThreading = false;
+    baseSettings.m_printProgress = false;
+    baseSettings.m_saveProgress = false;
+    baseSettings.m_useRegions = false;
+    baseSettings.m_improveRounds = 0;
+    baseSettings.m_randomizeTies = false;
+    baseSettings.m_solverType = SolverType_Greedy;
+    baseSettings.m_batchSize = 1;
+    baseSettings.m_coarseToFine = false;
+    
+    std::vector< PortfolioEntry > entries;
+    auto addEntry = [&]( const char* name, const std::function< void(SolverSettings&) >& configure )
+    {
+        PortfolioEntry entry = { name, baseSettings };
+        configure( entry.m_settings );
+        entries.push_back( entry );
+    };
+    
+    addEntry( "greedy", []( SolverSettings& ) {} );
+    addEntry( "greedy-batch-4", []( SolverSettings& entrySettings ) { entrySettings.m_batchSize = 4; } );
+    addEntry( "greedy-random-ties", []( SolverSettings& entrySettings ) { entrySettings.m_randomizeTies = true; } );
+    addEntry( "greedy-improve", [&]( SolverSettings& entrySettings ) { entrySettings.m_improveRounds = cPortfolioImproveRounds; } );
+    addEntry( "greedy-random-ties-improve", [&]( SolverSettings& entrySettings )
+        {
+            entrySettings.m_randomizeTies = true;
+            entrySettings.m_seed = settings.m_seed + 1;
+            entrySettings.m_improveRounds = cPortfolioImproveRounds;
+        }
+    );
+    addEntry( "regions-exact-improve", [&]( SolverSettings& entrySettings )
+        {
+            entrySettings.m_solverType = SolverType_BranchAndBound;
+            entrySettings.m_useRegions = true;
+            entrySettings.m_seed = settings.m_seed + 2;
+            entrySettings.m_improveRounds = cPortfolioImproveRounds;
+        }
+    );
+    addEntry( "coarse-greedy-improve", [&]( SolverSettings& entrySettings )
+        {
+            entrySettings.m_coarseToFine = true;
+            entrySettings.m_improveRounds = cPortfolioImproveRounds;
+        }
+    );
+    addEntry( "beam-4", []( SolverSettings& entrySettings )
+        {
+            entrySettings.m_solverType = SolverType_Beam;
+            entrySettings.m_beamWidth = 4;
+        }
+    );
+    
+    std::vector< std::shared_ptr< LegoSet > > entrySets( entries.size() );
+    std::function< void(int, int) > entryFunc = [&]( int taskIndex, int ) {
+        const SolverSettings& entrySettings = entries[ taskIndex ].m_settings;
+        std::shared_ptr< LegoSet > entrySet = std::make_shared< LegoSet >( legoSetInOut );
+        
+        bool solved = entrySettings.m_useRegions ? SolveRegions( bitmapView, *entrySet, entrySettings ) : RunSolver( bitmapView, *entrySet, entrySettings );
+        if( !solved && IsCancelled( entrySettings ) )
+        {
+            solved = FillUncovered( legoBitmap, *entrySet );
+        }
+        if( !solved )
+        {
+            return;
+        }
+        
+        if( entrySettings.m_improveRounds > 0 )
+        {
+            ImproveSolution( bitmapView, *entrySet, entrySettings );
+        }
+        if( entrySettings.m_mergeBricks )
+        {
+            MergeBricks( legoBitmap, *entrySet );
+        }
+        
+        PublishSolution( *entrySet, entrySettings );
+        entrySets[ taskIndex ] = entrySet;
+    };
+    
+    // Without threading the pool is a single inline worker, and the entries just run one after the other
+    m_threadPool->ParallelFor( (int)entries.size(), entryFunc );
+    
+    int winner = -1;
+    for( int i = 0; i < (int)entries.size(); i++ )
+    {
+        if( settings.m_printProgress )
+        {
+            if( entrySets[ i ] )
+            {
+                printf( "Portfolio: %-28s cost $%d.%02d, %d bricks\n", entries[ i ].m_name.c_str(), entrySets[ i ]->GetCost() / 100, entrySets[ i ]->GetCost() % 100, (int)entrySets[ i ]->GetBrickList().size() );
+            }
+            else
+            {
+                printf( "Portfolio: %-28s no solution\n", entries[ i ].m_name.c_str() );
+            }
+        }
+        
+        if( entrySets[ i ] && ( winner < 0 || entrySets[ i ]->GetCost() < entrySets[ winner ]->GetCost() ) )
+        {
+            winner = i;
+        }
+    }
+    
+    if( winner < 0 )
+    {
+        return false;
+    }
+    
+    m_portfolioWinner = entries[ winner ].m_name;
+    if( settings.m_printProgress )
+    {
+        printf( "Winner: %s\n", m_portfolioWinner.c_str() );
+    }
+    
+    legoSetInOut = *entrySets[ winner ];
+    ReportProgress( legoBitmap, legoSetInOut, settings );
+    return true;
+}
+
+bool LegoMosaic::SolveRegions( const std::shared_ptr< const LegoBitmap >& bitmapView, LegoSet& legoSetInOut, const SolverSettings& settings )
+{
+    const LegoBitmap& legoBitmap = *bitmapView;
+    const Vec2& boardSize = legoBitmap.GetBoardSize();
+    
+    std::vector< int > regionIds;
+    const int regionCount = legoBitmap.LabelRegions( regionIds );
+    
+    // Bounding box and size of each region
+    std::vector< Vec2 > regionMin( regionCount, boardSize );
+    std::vector< Vec2 > regionMax( regionCount, Vec2( -1, -1 ) );
+    std::vector< int > regionPegCounts( regionCount, 0 );
+    for( int y = 0; y < boardSize.y; y++ )
+    {
+        for( int x = 0; x < boardSize.x; x++ )
+        {
+            int regionId = regionIds[ y * boardSize.x + x ];
+            if( regionId >= 0 )
+            {
+                regionMin[ regionId ] = Vec2( std::min( regionMin[ regionId ].x, x ), std::min( regionMin[ regionId ].y, y ) );
+                regionMax[ regionId ] = Vec2( std::max( regionMax[ regionId ].x, x ), std::max( regionMax[ regionId ].y, y ) );
+                regionPegCounts[ regionId ]++;
+            }
+        }
+    }
+    
+    // Largest first, so the long regions start early and the small ones fill in the gaps at the end
+    std::vector< int > regionOrder( regionCount );
+    for( int i = 0; i < regionCount; i++ )
+    {
+        regionOrder[ i ] = i;
+    }
+    std::sort( regionOrder.begin(), regionOrder.end(), [&]( int a, int b )
+        {
+            return ( regionPegCounts[ a ] > regionPegCounts[ b ] ) || ( regionPegCounts[ a ] == regionPegCounts[ b ] && a < b );
+        }
+    );
+    
+    // The regions are the parallel work here; each engine runs inline, and quietly, since its board is only a piece of the image
+    SolverSettings regionSettings = settings;
+    regionSettings.m_useThreading = false;
+    regionSettings.m_printProgress = false;
+    regionSettings.m_saveProgress = false;
+    regionSettings.m_publishSolutions = false;
+    
+    std::vector< BrickList > regionBricks( regionCount );
+    std::vector< char > regionSolved( regionCount, 0 );
+    std::atomic< int > nextRegion( 0 );
+    
+    // One task per worker, each pulling the next-largest region until none are left
+    const int workerCount = settings.m_useThreading ? m_threadPool->GetWorkerCount() : 1;
+    std::function< void(int, int) > workFunc = [&]( int, int ) {
+        for( int orderIndex = nextRegion++; orderIndex < regionCount; orderIndex = nextRegion++ )
+        {
+            // Out of time: leave the rest uncovered, Solve(...) finishes them quickly
+            if( IsCancelled( settings ) )
+            {
+                break;
+            }
+            
+            int regionId = regionOrder[ orderIndex ];
+            Vec2 origin = regionMin[ regionId ];
+            Vec2 size( regionMax[ regionId ].x - origin.x + 1, regionMax[ regionId ].y - origin.y + 1 );
+            
+            std::shared_ptr< const LegoBitmap > regionBitmap = std::make_shared< LegoBitmap >( legoBitmap, origin, size, regionIds, regionId );
+            LegoSet regionSet( *regionBitmap, BrickList(), m_brickDefinitions );
+            
+            // A cancelled engine may leave a partial set; its bricks are still kept
+            regionSolved[ regionId ] = RunSolver( regionBitmap, regionSet, regionSettings ) ? 1 : 0;
+            
+            // Back to board coordinates
+            regionBricks[ regionId ] = regionSet.GetBrickList();
+            for( int i = 0; i < (int)regionBricks[ regionId ].size(); i++ )
+            {
+                regionBricks[ regionId ][ i ].m_position = Vec2( regionBricks[ regionId ][ i ].m_position.x + origin.x, regionBricks[ regionId ][ i ].m_position.y + origin.y );
+            }
+        }
+    };
+    
+    if( workerCount > 1 )
+    {
+        m_threadPool->ParallelFor( workerCount, workFunc );
+    }
+    else
+    {
+        workFunc( 0, 0 );
+    }
+    
+    // Merge in region order, so the brick list doesn't depend on which worker finished first
+    for( int regionId = 0; regionId < regionCount; regionId++ )
+    {
+        if( !regionSolved[ regionId ] && !IsCancelled( settings ) )
+        {
+            return false;
+        }
+        
+        const BrickList& bricks = regionBricks[ regionId ];
+        for( int i = 0; i < (int)bricks.size(); i++ )
+        {
+            if( !legoSetInOut.AddBrick( bricks[ i ], m_brickDefinitions, legoBitmap ) )
+            {
+                return false;
+            }
+        }
+    }
+    
+    if( settings.m_printProgress )
+    {
+        printf( "Solved %d regions\n", regionCount );
+    }
+    ReportProgress( legoBitmap, legoSetInOut, settings );
+    PublishSolution( legoSetInOut, settings );
+    
+    return IsSolved( legoSetInOut, legoBitmap );
+}
+
+bool LegoMosaic::SolveGreedy( const std::shared_ptr< const LegoBitmap >& bitmapView, LegoSet& legoSetInOut, const SolverSettings& settings )
+{
+    // Working state; it is published to the workers as a read-only snapshot, and only
+    // replaced (copy-on-write) if a snapshot is still held when the next brick is committed
+    const LegoBitmap& legoBitmap = *bitmapView;
+    std::shared_ptr< LegoSet > legoSet = std::make_shared< LegoSet >( legoSetInOut );
+    
+    // While not solved...
+    while( !IsSolved( *legoSet, legoBitmap ) )
+    {
+        if( IsCancelled( settings ) )
+        {
+            legoSetInOut = *legoSet;
+            return false;
+        }
+        
+        Vec2List nextPositions = GetNextPositions( *legoSet, legoBitmap );
+        
+        // Search this breadth, keeping the best candidate of each position
+        std::vector< BrickCandidate > positionBests;
+        {
+            std::shared_ptr< const LegoSet > setView = legoSet;
+            EvaluatePositions( bitmapView, setView, nextPositions, settings, positionBests );
+        }
+        
+        // Best first; since candidates are totally ordered, threaded and inline runs pick the same bricks
+        std::vector< int > order;
+        for( int i = 0; i < (int)positionBests.size(); i++ )
+        {
+            if( positionBests[ i ].IsValid() )
+            {
+                order.push_back( i );
+            }
+        }
+        // With randomized ties, equal ranks are ordered by a seeded hash of the placement instead of by position
+        std::sort( order.begin(), order.end(), [&]( int a, int b )
+            {
+                const BrickCandidate& candidateA = positionBests[ a ];
+                const BrickCandidate& candidateB = positionBests[ b ];
+                if( settings.m_randomizeTies && candidateA.m_rank == candidateB.m_rank )
+                {
+                    uint64_t tieA = ZobristMix( settings.m_seed ^ ZobristPlacementKey( candidateA.m_definitionId, 0, candidateA.m_position ) );
+                    uint64_t tieB = ZobristMix( settings.m_seed ^ ZobristPlacementKey( candidateB.m_definitionId, 0, candidateB.m_position ) );
+                    if( tieA != tieB )
+                    {
+                        return tieA < tieB;
+                    }
+                }
+                return candidateA.IsBetterThan( candidateB );
+            }
+        );
+        
+        // Nothing placeable: critical error (unsolvable)
+        if( order.empty() )
+        {
+            return false;
+        }
+        
+        if( legoSet.use_count() > 1 )
+        {
+            legoSet = std::make_shared< LegoSet >( *legoSet );
+        }
+        
+        // Commit the best brick, and in batched mode, every next-best one that doesn't overlap what was already
+        // committed this pass (a greedy maximal independent set); a batch size of one is the classic greedy
+        int batchCount = 0;
+        for( int i = 0; i < (int)order.size() && batchCount < std::max( settings.m_batchSize, 1 ); i++ )
+        {
+            const BrickCandidate& candidate = positionBests[ order[ i ] ];
+            int colorIndex = legoBitmap.GetBrickColorIndex( candidate.m_position );
+            Brick brick( candidate.m_definitionId, colorIndex, candidate.m_position );
+            
+            if( legoSet->AddBrick( brick, m_brickDefinitions, legoBitmap ) )
+            {
+                batchCount++;
+                ReportProgress( legoBitmap, *legoSet, settings );
+            }
+        }
+    }
+    
+    legoSetInOut = *legoSet;
+    return true;
+}
+
+void LegoMosaic::EvaluatePositions( const std::shared_ptr< const LegoBitmap >& bitmapView, const std::shared_ptr< const LegoSet >& setView, const Vec2List& positions, const SolverSettings& settings, std::vector< BrickCandidate >& positionBestsOut )
+{
+    // Split the work into (position, definition-range) tasks; small frontiers get their definitions cut
+    // into chunks so there are still enough tasks to keep every worker busy
+    const int positionCount = (int)positions.size();
+    const int definitionCount = (int)m_shapeIndex.size();
+    const int workerCount = settings.m_useThreading ? m_threadPool->GetWorkerCount() : 1;
+    int chunkCount = 1;
+    if( workerCount > 1 && positionCount < workerCount * cTasksPerWorker )
+    {
+        chunkCount = std::min( definitionCount, ( workerCount * cTasksPerWorker + positionCount - 1 ) / std::max( positionCount, 1 ) );
+    }
+    
+    // Each task keeps its own best (no locking), merged in task order below
+    const int taskCount = positionCount * chunkCount;
+    std::vector< BrickCandidate > taskBests( taskCount );
+    
+    // For each 1. Position, 2. Brick type, 3. Brick orientation
+    // Note that the color isn't searched; we just sample the position
+    // Workers share the snapshots by reference count; nothing board-sized is copied per task or per iteration
+    std::function< void(int, int) > workFunc = [&, bitmapView, setView, chunkCount, definitionCount]( int taskIndex, int ) {
+        
+        BrickCandidate& taskBest = taskBests[ taskIndex ];
+        
+        Vec2 nextPosition = positions[ taskIndex / chunkCount ];
+        int chunkIndex = taskIndex % chunkCount;
+        int defStart = definitionCount * chunkIndex / chunkCount;
+        int defEnd = definitionCount * ( chunkIndex + 1 ) / chunkCount;
+        
+        // Only shapes that fit the same-color space around this peg can be placed; since the shape index
+        // is sorted by width then height, we can stop on the first too-wide shape and skip ahead on too-tall ones
+        Vec2 fitExtent = setView->GetFitExtent( nextPosition );
+        
+        for( int shapeIndex = defStart; shapeIndex < defEnd; shapeIndex++ )
+        {
+            // Given the color and the brick type we want..
+            int defIndex = m_shapeIndex[ shapeIndex ];
+            int colorIndex = bitmapView->GetBrickColorIndex( nextPosition );
+            const BrickDefinition& brickDef = m_brickDefinitions.at( defIndex );
+            
+            if( brickDef.m_shape.x > fitExtent.x )
+            {
+                break;
+            }
+            else if( brickDef.m_shape.y > fitExtent.y )
+            {
+                shapeIndex = m_shapeIndexNextWidth[ shapeIndex ] - 1;
+                continue;
+            }
+            
+            // Move the brick in all four cardinal directions, since this position might have
+            // more empty space in any of the four corners..
+            Vec2 brickSize = brickDef.m_shape;
+            Vec2 positionOffset[ 4 ] = {
+                Vec2( 0, 0 ),
+                Vec2( -brickSize.x + 1, 0 ),
+                Vec2( 0, -brickSize.y + 1 ),
+                Vec2( -brickSize.x + 1, -brickSize.y + 1 ),
+            };
+            
+            for( int orientation = 0; orientation < 4; orientation++ )
+            {
+                Vec2 newPos( nextPosition.x + positionOffset[ orientation ].x, nextPosition.y + positionOffset[ orientation ].y );
+                Brick testBrick( defIndex, colorIndex, newPos );
+                
+                // If valid position *and* has a better rank; scored in-place, without copying the set
+                float rankDelta = 0.0f;
+                if( setView->ScoreBrick( testBrick, m_brickDefinitions, *bitmapView, rankDelta ) )
+                {
+                    BrickCandidate candidate( rankDelta, newPos, defIndex );
+                    if( candidate.IsBetterThan( taskBest ) )
+                    {
+                        taskBest = candidate;
+                    }
+                }
+                
+            } // .. For each orientation
+        } // ... For each brick definition
+    };
+    
+    // Frontiers with only a handful of candidates aren't worth waking up the workers for
+    if( workerCount > 1 && positionCount * definitionCount >= cMinParallelCandidates )
+    {
+        m_threadPool->ParallelFor( taskCount, workFunc );
+    }
+    else
+    {
+        for( int i = 0; i < taskCount; i++ )
+        {
+            workFunc( i, 0 );
+        }
+    }
+    
+    // Fixed-order reduction of each position's chunks
+    positionBestsOut.assign( positionCount, BrickCandidate() );
+    for( int i = 0; i < taskCount; i++ )
+    {
+        BrickCandidate& positionBest = positionBestsOut[ i / chunkCount ];
+        if( taskBests[ i ].IsBetterThan( positionBest ) )
+        {
+            positionBest = taskBests[ i ];
+        }
+    }
+}
+
+bool LegoMosaic::SolveGreedyQueue( const LegoBitmap& legoBitmap, LegoSet& legoSet, const SolverSettings& settings )
+{
+    // Within one pass, candidates only differ in rank by -100 * area / ( brickCount + 1 ) - cost, so that's the heap key.
+    // Keys only ever grow as bricks are added, so an old key is an optimistic bound: once an entry scored against the
+    // current brick count reaches the top, nothing below it can beat it, and this picks the same brick as SolveGreedy(...)
+    struct QueueEntry
+    {
+        BrickCandidate m_candidate;
+        int m_brickCount;
+    };
+    
+    auto isWorse = []( const QueueEntry& a, const QueueEntry& b ) { return b.m_candidate.IsBetterThan( a.m_candidate ); };
+    std::priority_queue< QueueEntry, std::vector< QueueEntry >, decltype( isWorse ) > candidateQueue( isWorse );
+    
+    auto getKey = [&]( int defIndex, int brickCount )
+    {
+        const BrickDefinition& brickDef = m_brickDefinitions[ defIndex ];
+        return - ( float( brickDef.m_shape.x * brickDef.m_shape.y ) / float( brickCount + 1 ) ) * 100.0f - float( brickDef.m_cost );
+    };
+    
+    // Frontier pegs are seeded once, when they first show up; an entry only goes stale when a later brick
+    // overlaps it, which only happens inside that brick's footprint, so it is simply re-checked when popped
+    const Vec2& boardSize = legoBitmap.GetBoardSize();
+    std::vector< char > seededPegs( boardSize.x * boardSize.y, 0 );
+    auto seedPosition = [&]( const Vec2& position )
+    {
+        seededPegs[ position.y * boardSize.x + position.x ] = 1;
+        
+        int colorIndex = legoBitmap.GetBrickColorIndex( position );
+        int brickCount = (int)legoSet.GetBrickList().size();
+        Vec2 fitExtent = legoSet.GetFitExtent( position );
+        
+        for( int shapeIndex = 0; shapeIndex < (int)m_shapeIndex.size(); shapeIndex++ )
+        {
+            int defIndex = m_shapeIndex[ shapeIndex ];
+            Vec2 brickSize = m_brickDefinitions[ defIndex ].m_shape;
+            if( brickSize.x > fitExtent.x )
+            {
+                break;
+            }
+            else if( brickSize.y > fitExtent.y )
+            {
+                shapeIndex = m_shapeIndexNextWidth[ shapeIndex ] - 1;
+                continue;
+            }
+            
+            // Same four corner placements as the greedy pass
+            Vec2 positionOffset[ 4 ] = {
+                Vec2( 0, 0 ),
+                Vec2( -brickSize.x + 1, 0 ),
+                Vec2( 0, -brickSize.y + 1 ),
+                Vec2( -brickSize.x + 1, -brickSize.y + 1 ),
+            };
+            
+            for( int orientation = 0; orientation < 4; orientation++ )
+            {
+                Vec2 newPos( position.x + positionOffset[ orientation ].x, position.y + positionOffset[ orientation ].y );
+                if( legoSet.CanAddBrick( Brick( defIndex, colorIndex, newPos ), m_brickDefinitions, legoBitmap ) )
+                {
+                    QueueEntry entry = { BrickCandidate( getKey( defIndex, brickCount ), newPos, defIndex ), brickCount };
+                    candidateQueue.push( entry );
+                }
+            }
+        }
+    };
+    
+    Vec2List nextPositions = GetNextPositions( legoSet, legoBitmap );
+    for( int i = 0; i < (int)nextPositions.size(); i++ )
+    {
+        seedPosition( nextPositions[ i ] );
+    }
+    
+    while( !IsSolved( legoSet, legoBitmap ) )
+    {
+        if( candidateQueue.empty() || IsCancelled( settings ) )
+        {
+            return false;
+        }
+        
+        QueueEntry entry = candidateQueue.top();
+        candidateQueue.pop();
+        
+        // Overlapped by a brick placed since it was scored: drop it
+        const BrickCandidate& candidate = entry.m_candidate;
+        int colorIndex = legoBitmap.GetBrickColorIndex( candidate.m_position );
+        Brick brick( candidate.m_definitionId, colorIndex, candidate.m_position );
+        if( !legoSet.CanAddBrick( brick, m_brickDefinitions, legoBitmap ) )
+        {
+            continue;
+        }
+        
+        // Scored against an older brick count: rescore and put it back
+        int brickCount = (int)legoSet.GetBrickList().size();
+        if( entry.m_brickCount != brickCount )
+        {
+            entry.m_candidate.m_rank = getKey( candidate.m_definitionId, brickCount );
+            entry.m_brickCount = brickCount;
+            candidateQueue.push( entry );
+            continue;
+        }
+        
+        legoSet.AddBrick( brick, m_brickDefinitions, legoBitmap );
+        ReportProgress( legoBitmap, legoSet, settings );
+        
+        // Seed any new frontier pegs; they can only be in the ring around the new brick
+        Vec2 brickSize = m_brickDefinitions[ brick.m_definitionId ].m_shape;
+        for( int y = brick.m_position.y - 1; y <= brick.m_position.y + brickSize.y; y++ )
+        {
+            for( int x = brick.m_position.x - 1; x <= brick.m_position.x + brickSize.x; x++ )
+            {
+                Vec2 pos( x, y );
+                if( x >= 0 && y >= 0 && x < boardSize.x && y < boardSize.y &&
+                    !seededPegs[ y * boardSize.x + x ] && legoSet.IsOnFrontier( pos ) )
+                {
+                    seedPosition( pos );
+                }
+            }
+        }
+    }
+    
+    return true;
+}
+
+bool LegoMosaic::SolveBruteForce( const LegoBitmap& legoBitmap, LegoSet& legoSetInOut, const SolverSettings& settings )
+{
+    // Depth-first over every tiling, on a single set with make / unmake; memory is the board plus the search depth
+    ExactSearch search( legoSetInOut, cTranspositionTableEntries );
+    search.m_transpositions.Store( legoSetInOut.GetCoverageHash(), legoSetInOut.GetCost() );
+    
+    LegoSet legoSet( legoSetInOut );
+    BruteForce( legoBitmap, legoSet, search, settings, Vec2( 0, 0 ) );
+    
+    // Cancelled or not, the incumbent is the best there is
+    if( !search.m_found )
+    {
+        return false;
+    }
+    
+    legoSetInOut = search.m_bestSet;
+    return true;
+}
+
+void LegoMosaic::BruteForce( const LegoBitmap& legoBitmap, LegoSet& legoSet, ExactSearch& search, const SolverSettings& settings, const Vec2& startPeg )
+{
+    search.m_nodeCount++;
+    if( IsCancelled( search, settings ) )
+    {
+        return;
+    }
+    
+    // If valid solution, keep it if it's the cheapest so far
+    if( IsSolved( legoSet, legoBitmap ) )
+    {
+        if( !search.m_found || legoSet.GetCost() < search.m_bestSet.GetCost() )
+        {
+            search.m_bestSet = legoSet;
+            search.m_found = true;
+            PublishSolution( legoSet, settings );
+            
+            if( settings.m_printProgress )
+            {
+                printf( "Found a solution; brick-count: %d, cost: $%d.%d\n", (int)legoSet.GetBrickList().size(), legoSet.GetCost() / 100, legoSet.GetCost() % 100 );
+            }
+            
+            // Draw out this solution; so we can track which solution ID maps to output
+            if( settings.m_saveProgress )
+            {
+                char fileName[ 512 ];
+                sprintf( fileName, "LegoMosaicProgress_%05d.png", int( search.m_nodeCount ) );
+                legoBitmap.SavePng( fileName, m_brickDefinitions, m_brickColors, legoSet );
+            }
+        }
+        return;
+    }
+    
+    // Exact-cover order: everything before the first uncovered peg is covered, so it can only be covered
+    // by a brick with its top-left corner on it; each tiling is generated once, in scan order
+    Vec2 branchPeg;
+    if( !legoSet.GetFirstUncoveredPeg( legoBitmap, startPeg, branchPeg ) )
+    {
+        return;
+    }
+    
+    int depth = legoSet.GetCheckpoint();
+    if( depth >= (int)search.m_placementStack.size() )
+    {
+        search.m_placementStack.resize( depth + 1 );
+    }
+    GetCanonicalPlacements( legoBitmap, legoSet, branchPeg, search.m_placementStack[ depth ] );
+    
+    for( int i = 0; i < (int)search.m_placementStack[ depth ].size(); i++ )
+    {
+        legoSet.AddBrick( search.m_placementStack[ depth ][ i ], m_brickDefinitions, legoBitmap );
+        
+        // Different tilings can still cover the same pegs; only the first (or a cheaper) arrival is grown
+        if( search.m_transpositions.Store( legoSet.GetCoverageHash(), legoSet.GetCost() ) )
+        {
+            if( settings.m_printProgress && legoBitmap.GetMosaicPegCount() > 0 )
+            {
+                printf( "Progress: %%%.2f, at search depth %d, search count %llu\n", ( float( legoSet.GetPlacedPegCount() ) / float( legoBitmap.GetMosaicPegCount() ) ) * 100.0f, (int)legoSet.GetBrickList().size(), (unsigned long long)search.m_nodeCount );
+            }
+            
+            BruteForce( legoBitmap, legoSet, search, settings, branchPeg );
+        }
+        
+        legoSet.RemoveLastBrick( m_brickDefinitions, legoBitmap );
+    }
+}
+
+bool LegoMosaic::SolveBranchAndBound( const std::shared_ptr< const LegoBitmap >& bitmapView, LegoSet& legoSetInOut, const SolverSettings& settings )
+{
+    const LegoBitmap& legoBitmap = *bitmapView;
+    
+    // Greedy gives the first incumbent, so the bound starts cutting right away
+    SolverSettings greedySettings = settings;
+    greedySettings.m_batchSize = 1;
+    greedySettings.m_printProgress = false;
+    greedySettings.m_saveProgress = false;
+    
+    ExactSearch search( legoSetInOut, cTranspositionTableEntries );
+    search.m_found = SolveGreedy( bitmapView, search.m_bestSet, greedySettings );
+    int greedyCost = search.m_bestSet.GetCost();
+    if( search.m_found )
+    {
+        PublishSolution( search.m_bestSet, settings );
+    }
+    
+    // A single working set is grown and shrunk in place for the whole search
+    LegoSet legoSet( legoSetInOut );
+    BranchAndBound( legoBitmap, legoSet, search, settings );
+    
+    // Greedy itself ran out of time: its partial set is all there is
+    if( !search.m_found )
+    {
+        if( IsCancelled( settings ) )
+        {
+            legoSetInOut = search.m_bestSet;
+        }
+        return false;
+    }
+    
+    if( settings.m_printProgress )
+    {
+        printf( "Branch and bound: %llu nodes%s, cost %d (greedy: %d)\n", (unsigned long long)search.m_nodeCount, search.m_cancelled ? " (cancelled)" : "", search.m_bestSet.GetCost(), greedyCost );
+    }
+    
+    legoSetInOut = search.m_bestSet;
+    ReportProgress( legoBitmap, legoSetInOut, settings );
+    return true;
+}
+
+void LegoMosaic::BranchAndBound( const LegoBitmap& legoBitmap, LegoSet& legoSet, ExactSearch& search, const SolverSettings& settings )
+{
+    search.m_nodeCount++;
+    if( IsCancelled( search, settings ) )
+    {
+        return;
+    }
+    
+    if( legoSet.IsSolved() )
+    {
+        if( !search.m_found || legoSet.GetCost() < search.m_bestSet.GetCost() )
+        {
+            search.m_bestSet = legoSet;
+            search.m_found = true;
+            PublishSolution( legoSet, settings );
+        }
+        return;
+    }
+    
+    // Only strictly cheaper sets are worth growing
+    if( search.m_found && GetCostLowerBound( legoSet ) >= search.m_bestSet.GetCost() )
+    {
+        return;
+    }
+    
+    // Reached this coverage before at no higher cost: everything below here was already searched (against a bound that has only tightened since)
+    if( !search.m_transpositions.Store( legoSet.GetCoverageHash(), legoSet.GetCost() ) )
+    {
+        return;
+    }
+    
+    // Every solution covers every peg, so branching on all the ways to cover one peg is complete
+    // Note that the most constrained peg prunes far better here than exact-cover order, since the bound does most of the work
+    Vec2 branchPeg;
+    if( !GetBranchPeg( legoSet, branchPeg ) )
+    {
+        return;
+    }
+    
+    // Placement lists are kept per depth and reused, so once the search has been this deep it doesn't allocate
+    int depth = legoSet.GetCheckpoint();
+    if( depth >= (int)search.m_placementStack.size() )
+    {
+        search.m_placementStack.resize( depth + 1 );
+    }
+    GetCoveringPlacements( legoBitmap, legoSet, branchPeg, search.m_placementStack[ depth ] );
+    
+    for( int i = 0; i < (int)search.m_placementStack[ depth ].size(); i++ )
+    {
+        legoSet.AddBrick( search.m_placementStack[ depth ][ i ], m_brickDefinitions, legoBitmap );
+        BranchAndBound( legoBitmap, legoSet, search, settings );
+        legoSet.RemoveLastBrick( m_brickDefinitions, legoBitmap );
+    }
+}
+
+bool LegoMosaic::SolveAStar( const std::shared_ptr< const LegoBitmap >& bitmapView, LegoSet& legoSetInOut, const SolverSettings& settings )
+{
+    const LegoBitmap& legoBitmap = *bitmapView;
+    
+    // Open states, cheapest f = cost + lower bound of the rest first; ties go to the state with less left to cover,
+    // then to the oldest, so the search order is deterministic
+    struct OpenEntry
+    {
+        int m_estimate;
+        int m_uncoveredPegCount;
+        uint64_t m_order;
+        std::shared_ptr< LegoSet > m_legoSet;
+        
+        bool operator<( const OpenEntry& other ) const
+        {
+            if( m_estimate != other.m_estimate ) return m_estimate > other.m_estimate;
+            if( m_uncoveredPegCount != other.m_uncoveredPegCount ) return m_uncoveredPegCount > other.m_uncoveredPegCount;
+            return m_order > other.m_order;
+        }
+    };
+    
+    std::priority_queue< OpenEntry > openSet;
+    uint64_t pushCount = 0;
+    size_t openMemory = 0;
+    
+    // Closed set: cheapest cost each coverage has been reached at; reaching it again at no lower cost is a dominated state
+    TranspositionTable closedSet( cTranspositionTableEntries );
+    
+    auto pushState = [&]( const std::shared_ptr< LegoSet >& legoSet )
+    {
+        OpenEntry entry;
+        entry.m_estimate = GetCostLowerBound( *legoSet );
+        entry.m_uncoveredPegCount = legoSet->GetUncoveredPegCount();
+        entry.m_order = pushCount++;
+        entry.m_legoSet = legoSet;
+        
+        openMemory += legoSet->GetMemoryUsage();
+        openSet.push( entry );
+    };
+    
+    closedSet.Store( legoSetInOut.GetCoverageHash(), legoSetInOut.GetCost() );
+    pushState( std::make_shared< LegoSet >( legoSetInOut ) );
+    
+    const size_t memoryBudget = size_t( std::max( settings.m_searchMemoryBudget, 1 ) ) * 1024 * 1024;
+    int expandedCount = 0;
+    bool optimal = false;
+    
+    while( !openSet.empty() )
+    {
+        // Out of budget: leave the best open state on the queue for greedy to finish
+        if( expandedCount >= settings.m_searchNodeBudget || openMemory >= memoryBudget || IsCancelled( settings ) )
+        {
+            break;
+        }
+        
+        OpenEntry entry = openSet.top();
+        openSet.pop();
+        openMemory -= entry.m_legoSet->GetMemoryUsage();
+        
+        // With an admissible estimate, the first complete set off the queue is the cheapest
+        if( entry.m_legoSet->IsSolved() )
+        {
+            legoSetInOut = *entry.m_legoSet;
+            optimal = true;
+            break;
+        }
+        
+        // Skip states that were reached more cheaply after they were queued
+        int closedCost = 0;
+        if( closedSet.Lookup( entry.m_legoSet->GetCoverageHash(), closedCost ) && closedCost < entry.m_legoSet->GetCost() )
+        {
+            continue;
+        }
+        
+        expandedCount++;
+        
+        Vec2 branchPeg;
+        if( !GetBranchPeg( *entry.m_legoSet, branchPeg ) )
+        {
+            continue;
+        }
+        
+        BrickList placements;
+        GetCoveringPlacements( legoBitmap, *entry.m_legoSet, branchPeg, placements );
+        for( int i = 0; i < (int)placements.size(); i++ )
+        {
+            std::shared_ptr< LegoSet > childSet = std::make_shared< LegoSet >( *entry.m_legoSet );
+            childSet->AddBrick( placements[ i ], m_brickDefinitions, legoBitmap );
+            
+            if( closedSet.Store( childSet->GetCoverageHash(), childSet->GetCost() ) )
+            {
+                pushState( childSet );
+            }
+        }
+    }
+    
+    // Nothing on the queue and nothing found: no way to cover the board
+    if( !optimal && openSet.empty() )
+    {
+        return false;
+    }
+    
+    int lowerBound = optimal ? legoSetInOut.GetCost() : openSet.top().m_estimate;
+    
+    // Out of time: no room for the greedy finish, Solve(...) completes the most promising open state quickly
+    if( !optimal && IsCancelled( settings ) )
+    {
+        legoSetInOut = *openSet.top().m_legoSet;
+        return false;
+    }
+    
+    if( !optimal )
+    {
+        // Finish the most promising open state with greedy, and keep it if it beats greedy from the start
+        SolverSettings greedySettings = settings;
+        greedySettings.m_batchSize = 1;
+        greedySettings.m_printProgress = false;
+        greedySettings.m_saveProgress = false;
+        
+        LegoSet bestOpenSet( *openSet.top().m_legoSet );
+        LegoSet rootSet( legoSetInOut );
+        bool bestOpenSolved = SolveGreedy( bitmapView, bestOpenSet, greedySettings );
+        bool rootSolved = SolveGreedy( bitmapView, rootSet, greedySettings );
+        
+        if( !bestOpenSolved && !rootSolved )
+        {
+            return false;
+        }
+        legoSetInOut = ( bestOpenSolved && ( !rootSolved || bestOpenSet.GetCost() <= rootSet.GetCost() ) ) ? bestOpenSet : rootSet;
+    }
+    
+    if( settings.m_printProgress )
+    {
+        float gap = ( legoSetInOut.GetCost() > 0 ) ? float( legoSetInOut.GetCost() - lowerBound ) / float( legoSetInOut.GetCost() ) * 100.0f : 0.0f;
+        printf( "A*: %s after %d expanded states; cost %d, lower bound %d, gap %.2f%%\n", optimal ? "optimal" : "out of budget", expandedCount, legoSetInOut.GetCost(), lowerBound, gap );
+    }
+    
+    PublishSolution( legoSetInOut, settings );
+    
+    ReportProgress( legoBitmap, legoSetInOut, settings );
+    return true;
+}
+
+bool LegoMosaic::SolveBeam( const std::shared_ptr< const LegoBitmap >& bitmapView, LegoSet& legoSetInOut, const SolverSettings& settings )
+{
+    const LegoBitmap& legoBitmap = *bitmapView;
+    const int workerCount = settings.m_useThreading ? m_threadPool->GetWorkerCount() : 1;
+    const size_t memoryBudget = size_t( std::max( settings.m_searchMemoryBudget, 1 ) ) * 1024 * 1024;
+    
+    // A child of the beam: the parent it grows from and the brick it adds
+    // Children compete on cost per covered peg, then on greedy rank; the lower bound on the total cost makes a poor
+    // score here, since it favors sets that skipped the awkward pegs that will cost the most to cover later
+    struct BeamChild
+    {
+        float m_costPerPeg;
+        float m_rank;
+        int m_parentIndex;
+        BrickCandidate m_candidate;
+        
+        bool IsBetterThan( const BeamChild& other ) const
+        {
+            if( m_costPerPeg != other.m_costPerPeg ) return m_costPerPeg < other.m_costPerPeg;
+            if( m_rank != other.m_rank ) return m_rank < other.m_rank;
+            if( m_parentIndex != other.m_parentIndex ) return m_parentIndex < other.m_parentIndex;
+            return m_candidate.IsBetterThan( other.m_candidate );
+        }
+    };
+    
+    std::vector< std::shared_ptr< LegoSet > > beam( 1, std::make_shared< LegoSet >( legoSetInOut ) );
+    std::shared_ptr< LegoSet > bestComplete;
+    if( legoSetInOut.IsSolved() )
+    {
+        return true;
+    }
+    
+    while( !beam.empty() )
+    {
+        // Out of time: the cheapest complete set if there is one, else the leading partial set for Solve(...) to finish
+        if( IsCancelled( settings ) )
+        {
+            legoSetInOut = bestComplete ? *bestComplete : *beam[ 0 ];
+            return bestComplete != NULL;
+        }
+        
+        // Hard memory cap: this beam and the next one are alive while stepping, and the candidate lists and
+        // allocator overhead take about as much again
+        size_t stateMemory = std::max( beam[ 0 ]->GetMemoryUsage(), size_t( 1 ) );
+        int beamWidth = std::max( 1, std::min( settings.m_beamWidth, int( memoryBudget / ( 3 * stateMemory ) ) ) );
+        
+        // Best candidate of each frontier position, per beam set; with a wide enough beam the sets are expanded
+        // side by side on the pool, otherwise one after the other with the pool working on each one's positions
+        std::vector< std::vector< BrickCandidate > > parentBests( beam.size() );
+        if( workerCount > 1 && (int)beam.size() >= workerCount )
+        {
+            SolverSettings inlineSettings = settings;
+            inlineSettings.m_useThreading = false;
+            
+            m_threadPool->ParallelFor( (int)beam.size(), [&]( int taskIndex, int ) {
+                std::shared_ptr< const LegoSet > setView = beam[ taskIndex ];
+                EvaluatePositions( bitmapView, setView, GetNextPositions( *setView, legoBitmap ), inlineSettings, parentBests[ taskIndex ] );
+            } );
+        }
+        else
+        {
+            for( int i = 0; i < (int)beam.size(); i++ )
+            {
+                std::shared_ptr< const LegoSet > setView = beam[ i ];
+                EvaluatePositions( bitmapView, setView, GetNextPositions( *setView, legoBitmap ), settings, parentBests[ i ] );
+            }
+        }
+        
+        // Each parent offers its best moves in greedy order, and no more of them than could survive
+        // A width of one thus only ever offers greedy's own choice
+        std::vector< BeamChild > children;
+        for( int parentIndex = 0; parentIndex < (int)beam.size(); parentIndex++ )
+        {
+            std::vector< BrickCandidate >& bests = parentBests[ parentIndex ];
+            bests.erase( std::remove_if( bests.begin(), bests.end(), []( const BrickCandidate& candidate ) { return !candidate.IsValid(); } ), bests.end() );
+            std::sort( bests.begin(), bests.end(), []( const BrickCandidate& a, const BrickCandidate& b ) { return a.IsBetterThan( b ); } );
+            
+            const LegoSet& parentSet = *beam[ parentIndex ];
+            for( int i = 0; i < (int)bests.size() && i < beamWidth; i++ )
+            {
+                const BrickDefinition& brickDef = m_brickDefinitions[ bests[ i ].m_definitionId ];
+                int placedPegCount = parentSet.GetPlacedPegCount() + brickDef.m_shape.x * brickDef.m_shape.y;
+                float costPerPeg = float( parentSet.GetCost() + brickDef.m_cost ) / float( placedPegCount );
+                
+                BeamChild child = { costPerPeg, parentSet.GetRank() + bests[ i ].m_rank, parentIndex, bests[ i ] };
+                children.push_back( child );
+            }
+        }
+        std::sort( children.begin(), children.end(), []( const BeamChild& a, const BeamChild& b ) { return a.IsBetterThan( b ); } );
+        
+        // Keep the best children, skipping any that cover the same pegs as a better one
+        std::vector< std::shared_ptr< LegoSet > > nextBeam;
+        std::unordered_set< uint64_t > nextHashes;
+        for( int i = 0; i < (int)children.size() && (int)nextBeam.size() < beamWidth; i++ )
+        {
+            const BeamChild& child = children[ i ];
+            const LegoSet& parentSet = *beam[ child.m_parentIndex ];
+            const BrickDefinition& brickDef = m_brickDefinitions[ child.m_candidate.m_definitionId ];
+            
+            uint64_t coverageHash = parentSet.GetCoverageHash();
+            for( int y = child.m_candidate.m_position.y; y < child.m_candidate.m_position.y + brickDef.m_shape.y; y++ )
+            {
+                for( int x = child.m_candidate.m_position.x; x < child.m_candidate.m_position.x + brickDef.m_shape.x; x++ )
+                {
+                    coverageHash ^= ZobristPegKey( y * legoBitmap.GetBoardSize().x + x );
+                }
+            }
+            if( nextHashes.count( coverageHash ) > 0 )
+            {
+                continue;
+            }
+            
+            std::shared_ptr< LegoSet > childSet = std::make_shared< LegoSet >( parentSet );
+            Brick brick( child.m_candidate.m_definitionId, legoBitmap.GetBrickColorIndex( child.m_candidate.m_position ), child.m_candidate.m_position );
+            childSet->AddBrick( brick, m_brickDefinitions, legoBitmap );
+            
+            // Finished sets leave the beam; only the cheapest is kept, and nothing that can't beat it is grown further
+            if( childSet->IsSolved() )
+            {
+                if( !bestComplete || childSet->GetCost() < bestComplete->GetCost() )
+                {
+                    bestComplete = childSet;
+                    PublishSolution( *bestComplete, settings );
+                }
+                continue;
+            }
+            if( bestComplete && GetCostLowerBound( *childSet ) >= bestComplete->GetCost() )
+            {
+                continue;
+            }
+            
+            nextBeam.push_back( childSet );
+            nextHashes.insert( coverageHash );
+        }
+        
+        beam.swap( nextBeam );
+        if( !beam.empty() )
+        {
+            ReportProgress( legoBitmap, *beam[ 0 ], settings );
+        }
+    }
+    
+    if( !bestComplete )
+    {
+        return false;
+    }
+    
+    legoSetInOut = *bestComplete;
+    ReportProgress( legoBitmap, legoSetInOut, settings );
+    return true;
+}
+
+int LegoMosaic::PlaceCoarseBlocks( const LegoBitmap& legoBitmap, LegoSet& legoSetInOut )
+{
+    const Vec2& boardSize = legoBitmap.GetBoardSize();
+    
+    // Coarsest level: blocks no larger than the longest side in the catalog
+    int maxSide = 1;
+    for( int i = 0; i < (int)m_brickDefinitions.size(); i++ )
+    {
+        maxSide = std::max( maxSide, std::max( m_brickDefinitions[ i ].m_shape.x, m_brickDefinitions[ i ].m_shape.y ) );
+    }
+    int topLevel = 0;
+    while( ( 2 << topLevel ) <= maxSide )
+    {
+        topLevel++;
+    }
+    if( topLevel < cCoarseMinLevel )
+    {
+        return 0;
+    }
+    
+    // Uniform-block pyramid: a block of level k is its color if all of its 2^k x 2^k free pegs have that color, else -1
+    // Level 0 is the board itself, with covered pegs as -1; each level is built from the four blocks below it
+    std::vector< std::vector< int > > levels( topLevel + 1 );
+    std::vector< Vec2 > levelSizes( topLevel + 1 );
+    levelSizes[ 0 ] = boardSize;
+    levels[ 0 ].resize( boardSize.x * boardSize.y );
+    for( int y = 0; y < boardSize.y; y++ )
+    {
+        for( int x = 0; x < boardSize.x; x++ )
+        {
+            Vec2 pos( x, y );
+            levels[ 0 ][ y * boardSize.x + x ] = legoSetInOut.IsPegOccupied( pos ) ? -1 : legoBitmap.GetBrickColorIndex( pos );
+        }
+    }
+    
+    for( int level = 1; level <= topLevel; level++ )
+    {
+        const Vec2& childSize = levelSizes[ level - 1 ];
+        const std::vector< int >& children = levels[ level - 1 ];
+        
+        // Blocks hanging off the board are never uniform
+        levelSizes[ level ] = Vec2( childSize.x / 2, childSize.y / 2 );
+        levels[ level ].resize( levelSizes[ level ].x * levelSizes[ level ].y );
+        for( int y = 0; y < levelSizes[ level ].y; y++ )
+        {
+            for( int x = 0; x < levelSizes[ level ].x; x++ )
+            {
+                int color = children[ ( 2 * y ) * childSize.x + 2 * x ];
+                if( children[ ( 2 * y ) * childSize.x + 2 * x + 1 ] != color || children[ ( 2 * y + 1 ) * childSize.x + 2 * x ] != color || children[ ( 2 * y + 1 ) * childSize.x + 2 * x + 1 ] != color )
+                {
+                    color = -1;
+                }
+                levels[ level ][ y * levelSizes[ level ].x + x ] = color;
+            }
+        }
+    }
+    
+    // Coarse to fine; a block is free until a rectangle takes it, and a rectangle takes whole blocks of every finer level,
+    // so the finer levels just skip blocks with any taken peg
+    std::vector< char > takenPegs( boardSize.x * boardSize.y, 0 );
+    BrickList coarseBricks;
+    for( int level = topLevel; level >= cCoarseMinLevel; level-- )
+    {
+        const int blockSize = 1 << level;
+        const Vec2& gridSize = levelSizes[ level ];
+        const std::vector< int >& blocks = levels[ level ];
+        auto isFree = [&]( int x, int y, int color )
         {
-            BrickDefinition newDef( brickDef );
-            newDef.m_definitionId = (int)m_brickDefinitions.size();
-            newDef.m_shape = Vec2( newDef.m_shape.y, newDef.m_shape.x );
-            
-            m_brickDefinitions.push_back( newDef );
+            return blocks[ y * gridSize.x + x ] == color && !takenPegs[ ( y * blockSize ) * boardSize.x + x * blockSize ];
+        };
+        
+        for( int y = 0; y < gridSize.y; y++ )
+        {
+            for( int x = 0; x < gridSize.x; x++ )
+            {
+                int color = blocks[ y * gridSize.x + x ];
+                if( color < 0 || !isFree( x, y, color ) )
+                {
+                    continue;
+                }
+                
+                // Grow right, then down while the whole span below matches
+                int width = 1;
+                while( x + width < gridSize.x && isFree( x + width, y, color ) )
+                {
+                    width++;
+                }
+                int height = 1;
+                for( bool grow = true; grow && y + height < gridSize.y; )
+                {
+                    for( int i = 0; i < width && grow; i++ )
+                    {
+                        grow = isFree( x + i, y + height, color );
+                    }
+                    height += grow ? 1 : 0;
+                }
+                
+                Vec2 origin( x * blockSize, y * blockSize );
+                Vec2 size( width * blockSize, height * blockSize );
+                if( !CoverRectangle( origin, size, color, coarseBricks ) )
+                {
+                    continue;
+                }
+                for( int py = origin.y; py < origin.y + size.y; py++ )
+                {
+                    memset( &takenPegs[ py * boardSize.x + origin.x ], 1, size.x );
+                }
+            }
         }
     }
     
-    // Note that we should sort our bricks to be based on relative peg / cost unit
-    // I'm aware qsort is *not* to be mixed with C++, but std::swap requires tons of overhead code for not much gain
-    std::qsort( (void*)&brickDefinitions[0], brickDefinitions.size(), sizeof( BrickDefinition ), BrickDefinitionCompare );
+    for( int i = 0; i < (int)coarseBricks.size(); i++ )
+    {
+        if( !legoSetInOut.AddBrick( coarseBricks[ i ], m_brickDefinitions, legoBitmap ) )
+        {
+            return -1;
+        }
+    }
+    return (int)coarseBricks.size();
 }
 
-LegoMosaic::~LegoMosaic()
+bool LegoMosaic::CoverRectangle( const Vec2& origin, const Vec2& size, int colorIndex, BrickList& bricksOut ) const
 {
-    delete m_solutionSet;
+    return m_tilingTable->Tile( origin, size, colorIndex, bricksOut );
 }
 
-void LegoMosaic::Solve( const char* fileName, bool saveProgress, bool useBruteForce, bool useThreading, bool dither )
+bool LegoMosaic::SolveMaxRect( const LegoBitmap& legoBitmap, LegoSet& legoSetInOut, const SolverSettings& settings )
 {
-    // 1. Load the image
-    LegoBitmap legoBitmap( fileName );
-    if( legoBitmap.ConvertMosaic( m_brickColors, dither ) == false )
+    const Vec2& boardSize = legoBitmap.GetBoardSize();
+    const int width = boardSize.x;
+    
+    // Color of every free peg, -1 once it is covered (or if it never had one)
+    std::vector< int > pegColors( boardSize.x * boardSize.y );
+    for( int y = 0; y < boardSize.y; y++ )
     {
-        printf( "Unable to convert the given file \"%s\" to the given Lego colors\n", fileName ? fileName : NULL );
+        for( int x = 0; x < boardSize.x; x++ )
+        {
+            Vec2 pos( x, y );
+            pegColors[ y * width + x ] = legoSetInOut.IsPegOccupied( pos ) ? -1 : legoBitmap.GetBrickColorIndex( pos );
+        }
     }
-    legoBitmap.SavePng( "LegoMosaicProgress_Output.png", m_brickColors );
-    
-    m_boardSize = legoBitmap.GetBoardSize();
     
-    BrickList brickList;
-    m_solutionSet = new LegoSet( m_boardSize, brickList, m_brickDefinitions );
+    // Run-up table: free pegs of the peg's color straight up from it, counting itself
+    std::vector< int > runUp( boardSize.x * boardSize.y, 0 );
+    auto refreshRunUp = [&]( int x, int y )
+    {
+        int pegIndex = y * width + x;
+        int color = pegColors[ pegIndex ];
+        runUp[ pegIndex ] = ( color < 0 ) ? 0 : ( ( y > 0 && pegColors[ pegIndex - width ] == color ) ? runUp[ pegIndex - width ] + 1 : 1 );
+    };
+    for( int y = 0; y < boardSize.y; y++ )
+    {
+        for( int x = 0; x < boardSize.x; x++ )
+        {
+            refreshRunUp( x, y );
+        }
+    }
     
-    // 2a. A* searching algorithm
-    if( useBruteForce == false )
+    // Largest rectangle with its bottom edge on the given row: the histogram / stack method over the run-ups, where a
+    // change of color ends the histogram, since a rectangle has to be one color; ties go to the leftmost
+    struct RowBest
+    {
+        int m_area;
+        Vec2 m_origin;
+        Vec2 m_size;
+    };
+    std::vector< int > stack;
+    auto findRowBest = [&]( int y )
     {
-        // Empty starting state
-        LegoSet legoSet( m_boardSize, brickList, m_brickDefinitions );
+        RowBest best = { 0, Vec2( 0, 0 ), Vec2( 0, 0 ) };
+        const int* heights = &runUp[ y * width ];
+        const int* colors = &pegColors[ y * width ];
         
-        // While not solved...
-        while( !IsSolved( legoSet, legoBitmap ) )
+        stack.clear();
+        int spanStart = 0;
+        for( int x = 0; x <= width; x++ )
         {
-            Vec2List nextPositions = GetNextPositions( legoSet, legoBitmap );
-            
-            // Search this breadth; arbitrary (invalid) initial rank
-            std::mutex bestDataLock;
-            int bestDefinitionIndex = -1;
-            Vec2 bestPosition;
-            float bestRank = 9999999.0f;
-            
-            // Enqueue all of these search depths as threads..
-            std::vector< std::thread > searchThreads;
-            int maxThreadCount = std::thread::hardware_concurrency();
-            int threadCount = 0;
-            
-            // For each 1. Position, 2. Brick type, 3. Brick orientation
-            // Note that the color isn't searched; we just sample the position
-            for( int posIndex = 0; posIndex < (int)nextPositions.size(); posIndex++ )
+            bool spanEnd = ( x == width ) || ( x > 0 && colors[ x ] != colors[ x - 1 ] );
+            while( !stack.empty() && ( spanEnd || heights[ stack.back() ] >= heights[ x ] ) )
             {
-                Vec2 nextPosition = nextPositions[ posIndex ];
-                
-                std::function< void() > workFunc = [=, &bestDataLock, &bestRank, &bestPosition, &bestDefinitionIndex]() {
-                    
-                    for( int defIndex = 0; defIndex < (int)m_brickDefinitions.size(); defIndex++ )
-                    {
-                        // Given the color and the brick type we want..
-                        int colorIndex = legoBitmap.GetBrickColorIndex( nextPosition );
-                        BrickDefinition& brickDef = m_brickDefinitions.at( defIndex );
-                        
-                        // Move the brick in all four cardinal directions, since this position might have
-                        // more empty space in any of the four corners..
-                        Vec2 brickSize = brickDef.m_shape;
-                        Vec2 positionOffset[ 4 ] = {
-                            Vec2( 0, 0 ),
-                            Vec2( -brickSize.x + 1, 0 ),
-                            Vec2( 0, -brickSize.y + 1 ),
-                            Vec2( -brickSize.x + 1, -brickSize.y + 1 ),
-                        };
-                        
-                        for( int orientation = 0; orientation < 4; orientation++ )
-                        {
-                            Vec2 newPos( nextPosition.x + positionOffset[ orientation ].x, nextPosition.y + positionOffset[ orientation ].y );
-                            Brick testBrick( defIndex, colorIndex, newPos );
-                            LegoSet testSet( legoSet );
-                            
-                            // If valid position *and* has a better rank...
-                            if( testSet.AddBrick( testBrick, m_brickDefinitions, legoBitmap ) )
-                            {
-                                std::lock_guard< std::mutex > guard( bestDataLock );
-                                
-                                float newRank = testSet.GetRank();
-                                if( newRank < bestRank )
-                                {
-                                    bestRank = newRank;
-                                    bestPosition = newPos;
-                                    bestDefinitionIndex = defIndex;
-                                }
-                            }
-                            
-                        } // .. For each orientation
-                    } // ... For each brick definition
-                };
+                int height = heights[ stack.back() ];
+                stack.pop_back();
                 
-                // Each thread uses the same position but tried different bricks..
-                if( useThreading )
+                int left = stack.empty() ? spanStart : stack.back() + 1;
+                if( height * ( x - left ) > best.m_area )
                 {
-                    threadCount++;
-                    searchThreads.push_back( std::thread( workFunc ) );
-                    
-                    // If we hit the max number of threads, join them
-                    if( threadCount >= maxThreadCount )
-                    {
-                        int count = threadCount;
-                        for( int i = count - 1; i >= 0; i-- )
-                        {
-                            searchThreads.at( i ).join();
-                            searchThreads.pop_back();
-                            threadCount--;
-                        }
-                    }
+                    best.m_area = height * ( x - left );
+                    best.m_origin = Vec2( left, y - height + 1 );
+                    best.m_size = Vec2( x - left, height );
                 }
-                else
+            }
+            
+            if( spanEnd )
+            {
+                spanStart = x;
+            }
+            if( x < width )
+            {
+                stack.push_back( x );
+            }
+        }
+        return best;
+    };
+    
+    // Row bests, largest first (then topmost); an entry is stale once its row has been rescanned since it was pushed
+    struct HeapEntry
+    {
+        int m_area;
+        int m_row;
+        int m_version;
+        
+        bool operator<( const HeapEntry& other ) const
+        {
+            if( m_area != other.m_area ) return m_area < other.m_area;
+            return m_row > other.m_row;
+        }
+    };
+    std::priority_queue< HeapEntry > rowHeap;
+    std::vector< RowBest > rowBests( boardSize.y );
+    std::vector< int > rowVersions( boardSize.y, 0 );
+    auto rescanRow = [&]( int y )
+    {
+        rowBests[ y ] = findRowBest( y );
+        rowVersions[ y ]++;
+        if( rowBests[ y ].m_area > 0 )
+        {
+            HeapEntry entry = { rowBests[ y ].m_area, y, rowVersions[ y ] };
+            rowHeap.push( entry );
+        }
+    };
+    for( int y = 0; y < boardSize.y; y++ )
+    {
+        rescanRow( y );
+    }
+    
+    BrickList bricks = legoSetInOut.GetBrickList();
+    while( !rowHeap.empty() )
+    {
+        HeapEntry entry = rowHeap.top();
+        rowHeap.pop();
+        if( entry.m_version != rowVersions[ entry.m_row ] )
+        {
+            continue;
+        }
+        
+        if( IsCancelled( settings ) )
+        {
+            legoSetInOut = LegoSet( legoBitmap, bricks, m_brickDefinitions );
+            return false;
+        }
+        
+        const RowBest best = rowBests[ entry.m_row ];
+        const int lastRow = best.m_origin.y + best.m_size.y - 1;
+        if( !CoverRectangle( best.m_origin, best.m_size, pegColors[ best.m_origin.y * width + best.m_origin.x ], bricks ) )
+        {
+            legoSetInOut = LegoSet( legoBitmap, bricks, m_brickDefinitions );
+            return false;
+        }
+        
+        for( int y = best.m_origin.y; y <= lastRow; y++ )
+        {
+            std::fill( &pegColors[ y * width + best.m_origin.x ], &pegColors[ y * width + best.m_origin.x + best.m_size.x ], -1 );
+        }
+        
+        // Run-ups change inside the rectangle and down each of its columns for as long as the run went on through it
+        int dirtyEnd = lastRow;
+        for( int x = best.m_origin.x; x < best.m_origin.x + best.m_size.x; x++ )
+        {
+            for( int y = best.m_origin.y; y < boardSize.y; y++ )
+            {
+                int oldRunUp = runUp[ y * width + x ];
+                refreshRunUp( x, y );
+                if( y > lastRow && runUp[ y * width + x ] == oldRunUp )
                 {
-                    workFunc();
+                    break;
                 }
+                dirtyEnd = std::max( dirtyEnd, y );
             }
-            
-            if( useThreading )
+        }
+        
+        for( int y = best.m_origin.y; y <= dirtyEnd; y++ )
+        {
+            rescanRow( y );
+        }
+    }
+    
+    legoSetInOut = LegoSet( legoBitmap, bricks, m_brickDefinitions );
+    ReportProgress( legoBitmap, legoSetInOut, settings );
+    return legoSetInOut.IsSolved();
+}
+
+bool LegoMosaic::SolvePartition( const LegoBitmap& legoBitmap, LegoSet& legoSetInOut, const SolverSettings& settings )
+{
+    const Vec2& boardSize = legoBitmap.GetBoardSize();
+    
+    std::vector< int > regionIds;
+    const int regionCount = legoBitmap.LabelRegions( regionIds );
+    
+    std::vector< Vec2 > regionMin( regionCount, boardSize );
+    std::vector< Vec2 > regionMax( regionCount, Vec2( -1, -1 ) );
+    for( int y = 0; y < boardSize.y; y++ )
+    {
+        for( int x = 0; x < boardSize.x; x++ )
+        {
+            int regionId = regionIds[ y * boardSize.x + x ];
+            if( regionId >= 0 )
+            {
+                regionMin[ regionId ] = Vec2( std::min( regionMin[ regionId ].x, x ), std::min( regionMin[ regionId ].y, y ) );
+                regionMax[ regionId ] = Vec2( std::max( regionMax[ regionId ].x, x ), std::max( regionMax[ regionId ].y, y ) );
+            }
+        }
+    }
+    
+    // Stage 1: the rectangles of every region, as cells of its bounding box; pegs that are already covered are left out
+    BrickList bricks = legoSetInOut.GetBrickList();
+    std::vector< char > cells;
+    std::vector< PartitionRect > rectangles;
+    int rectangleCount = 0;
+    for( int regionId = 0; regionId < regionCount; regionId++ )
+    {
+        if( IsCancelled( settings ) )
+        {
+            legoSetInOut = LegoSet( legoBitmap, bricks, m_brickDefinitions );
+            return false;
+        }
+        
+        const Vec2 origin = regionMin[ regionId ];
+        const Vec2 size( regionMax[ regionId ].x - origin.x + 1, regionMax[ regionId ].y - origin.y + 1 );
+        int colorIndex = -1;
+        
+        cells.assign( size.x * size.y, 0 );
+        for( int y = 0; y < size.y; y++ )
+        {
+            for( int x = 0; x < size.x; x++ )
             {
-                // Wait for all the rest to finish
-                int count = threadCount;
-                for( int i = count - 1; i >= 0; i-- )
+                Vec2 pos( origin.x + x, origin.y + y );
+                if( regionIds[ pos.y * boardSize.x + pos.x ] == regionId && !legoSetInOut.IsPegOccupied( pos ) )
                 {
-                    searchThreads.at( i ).join();
-                    searchThreads.pop_back();
+                    cells[ y * size.x + x ] = 1;
+                    colorIndex = legoBitmap.GetBrickColorIndex( pos );
                 }
             }
+        }
+        
+        rectangles.clear();
+        rectangleCount += PartitionIntoRectangles( cells, size, rectangles );
+        
+        // Stage 2: bricks for each rectangle
+        for( int i = 0; i < (int)rectangles.size(); i++ )
+        {
+            Vec2 rectangleOrigin( origin.x + rectangles[ i ].m_origin.x, origin.y + rectangles[ i ].m_origin.y );
+            if( !CoverRectangle( rectangleOrigin, rectangles[ i ].m_size, colorIndex, bricks ) )
+            {
+                legoSetInOut = LegoSet( legoBitmap, bricks, m_brickDefinitions );
+                return false;
+            }
+        }
+    }
+    
+    if( settings.m_printProgress )
+    {
+        printf( "Partitioned %d regions into %d rectangles\n", regionCount, rectangleCount );
+    }
+    
+    legoSetInOut = LegoSet( legoBitmap, bricks, m_brickDefinitions );
+    ReportProgress( legoBitmap, legoSetInOut, settings );
+    return legoSetInOut.IsSolved();
+}
+
+bool LegoMosaic::SolveScanline( const LegoBitmap& legoBitmap, LegoSet& legoSetInOut, const SolverSettings& settings )
+{
+    const Vec2& boardSize = legoBitmap.GetBoardSize();
+    
+    // Definitions by cost per peg, larger ones first on ties; the first one that fits an anchor is the one placed
+    std::vector< int > definitionOrder( m_brickDefinitions.size() );
+    Vec2 maxShape( 1, 1 );
+    for( int i = 0; i < (int)m_brickDefinitions.size(); i++ )
+    {
+        definitionOrder[ i ] = i;
+        maxShape = Vec2( std::max( maxShape.x, m_brickDefinitions[ i ].m_shape.x ), std::max( maxShape.y, m_brickDefinitions[ i ].m_shape.y ) );
+    }
+    std::sort( definitionOrder.begin(), definitionOrder.end(), [&]( int a, int b )
+        {
+            const BrickDefinition& defA = m_brickDefinitions[ a ];
+            const BrickDefinition& defB = m_brickDefinitions[ b ];
+            int areaA = defA.m_shape.x * defA.m_shape.y;
+            int areaB = defB.m_shape.x * defB.m_shape.y;
+            if( defA.m_cost * areaB != defB.m_cost * areaA ) return defA.m_cost * areaB < defB.m_cost * areaA;
+            if( areaA != areaB ) return areaA > areaB;
+            return a < b;
+        }
+    );
+    
+    // Rolling occupancy: a brick anchored on row y reaches no further than row y + maxShape.y - 1, so only those rows
+    // are kept, row r in slot r % maxShape.y; a slot is cleared and reloaded as the scan leaves its row
+    std::vector< char > windowRows( maxShape.y * boardSize.x, 0 );
+    auto loadRow = [&]( int y )
+    {
+        char* row = &windowRows[ ( y % maxShape.y ) * boardSize.x ];
+        for( int x = 0; x < boardSize.x; x++ )
+        {
+            row[ x ] = ( y < boardSize.y && legoSetInOut.IsPegOccupied( Vec2( x, y ) ) ) ? 1 : 0;
+        }
+    };
+    for( int y = 0; y < maxShape.y; y++ )
+    {
+        loadRow( y );
+    }
+    
+    BrickList bricks = legoSetInOut.GetBrickList();
+    std::vector< int > fitWidths( maxShape.y, 0 );
+    
+    for( int y = 0; y < boardSize.y; y++ )
+    {
+        if( IsCancelled( settings ) )
+        {
+            legoSetInOut = LegoSet( legoBitmap, bricks, m_brickDefinitions );
+            return false;
+        }
+        
+        const char* anchorRow = &windowRows[ ( y % maxShape.y ) * boardSize.x ];
+        for( int x = 0; x < boardSize.x; x++ )
+        {
+            int colorIndex = legoBitmap.GetBrickColorIndex( Vec2( x, y ) );
+            if( anchorRow[ x ] || colorIndex < 0 )
+            {
+                continue;
+            }
             
-            // Copy over the best, if any found, else it's a critical error (unsolvable)
-            if( bestDefinitionIndex >= 0 )
+            // Fit profile: fitWidths[ dy ] is the widest free, same-color span over rows y to y + dy, starting at x
+            int fitHeight = 0;
+            int fitWidth = maxShape.x;
+            for( int dy = 0; dy < maxShape.y && y + dy < boardSize.y; dy++ )
             {
-                // Add it to the solution set!
-                int colorIndex = legoBitmap.GetBrickColorIndex( bestPosition );
-                Brick brick( bestDefinitionIndex, colorIndex, bestPosition );
-                
-                if( legoSet.AddBrick( brick, m_brickDefinitions, legoBitmap ) == false )
+                const char* fitRow = &windowRows[ ( ( y + dy ) % maxShape.y ) * boardSize.x ];
+                int run = 0;
+                while( run < fitWidth && x + run < boardSize.x && !fitRow[ x + run ] && legoBitmap.GetBrickColorIndex( Vec2( x + run, y + dy ) ) == colorIndex )
                 {
-                    printf( "Critical error: unable to place a brick that was verified good\n" );
+                    run++;
                 }
                 
-                *m_solutionSet = legoSet;
-                
-                // Show progress: write it out to memory
-                int searchDepth = (int)legoSet.GetBrickList().size();
-                
-                if( saveProgress )
+                if( run == 0 )
                 {
-                    char fileName[ 512 ];
-                    sprintf( fileName, "LegoMosaicProgress_%05d.png", searchDepth );
-                    legoBitmap.SavePng( fileName, m_brickDefinitions, m_brickColors, legoSet );
+                    break;
                 }
-                
-                if( legoBitmap.GetMosaicPegCount() > 0 )
+                fitWidth = run;
+                fitWidths[ dy ] = run;
+                fitHeight = dy + 1;
+            }
+            
+            int definitionId = -1;
+            for( int i = 0; i < (int)definitionOrder.size() && definitionId < 0; i++ )
+            {
+                const Vec2& shape = m_brickDefinitions[ definitionOrder[ i ] ].m_shape;
+                if( shape.y <= fitHeight && shape.x <= fitWidths[ shape.y - 1 ] )
                 {
-                    printf( "Progress: %%%.2f, at search depth %d\n", ( float( legoSet.GetPlacedPegCount() ) / float( legoBitmap.GetMosaicPegCount() ) * 100.0f ), searchDepth );
+                    definitionId = definitionOrder[ i ];
                 }
             }
-            else
+            
+            // Only happens with a catalog that has no 1x1
+            if( definitionId < 0 )
+            {
+                legoSetInOut = LegoSet( legoBitmap, bricks, m_brickDefinitions );
+                return false;
+            }
+            
+            const Vec2& shape = m_brickDefinitions[ definitionId ].m_shape;
+            for( int dy = 0; dy < shape.y; dy++ )
             {
-                printf( "Critical error: unable to place a brick into an unsolved set\n" );
-                exit( 0 );
+                memset( &windowRows[ ( ( y + dy ) % maxShape.y ) * boardSize.x + x ], 1, shape.x );
             }
+            bricks.push_back( Brick( definitionId, colorIndex, Vec2( x, y ) ) );
+            x += shape.x - 1;
         }
         
+        // Row y is done; its slot now holds row y + maxShape.y
+        loadRow( y + maxShape.y );
     }
     
-    // 2b. Breadth-first exhaustive search
-    else
+    legoSetInOut = LegoSet( legoBitmap, bricks, m_brickDefinitions );
+    ReportProgress( legoBitmap, legoSetInOut, settings );
+    return legoSetInOut.IsSolved();
+}
+
+bool LegoMosaic::GetBranchPeg( const LegoSet& legoSet, Vec2& pegOut ) const
+{
+    // Fewest ways to cover it means the fewest branches
+    const Vec2List& frontier = legoSet.GetFrontier();
+    int branchFit = INT_MAX;
+    pegOut = Vec2( -1, -1 );
+    
+    for( int i = 0; i < (int)frontier.size(); i++ )
     {
-        std::deque< LegoSet > workingQueue;
-        std::vector< LegoSet > solutionList;
-        
-        // Start with empty base case
-        LegoSet legoSet( m_boardSize, brickList, m_brickDefinitions );
-        workingQueue.push_back( legoSet );
+        const Vec2& pos = frontier[ i ];
+        Vec2 fitExtent = legoSet.GetFitExtent( pos );
+        int fit = fitExtent.x * fitExtent.y;
+        if( fit < branchFit || ( fit == branchFit && ( pos.y < pegOut.y || ( pos.y == pegOut.y && pos.x < pegOut.x ) ) ) )
+        {
+            pegOut = pos;
+            branchFit = fit;
+        }
+    }
+    
+    return pegOut.x >= 0;
+}
+
+int LegoMosaic::GetCostLowerBound( const LegoSet& legoSet ) const
+{
+    // Rounded up, since costs are whole pennies; the small epsilon keeps float error from overshooting an exact bound
+    return legoSet.GetCost() + (int)ceilf( float( legoSet.GetUncoveredPegCount() ) * m_bestCostPerPeg - 0.001f );
+}
+
+void LegoMosaic::GetCoveringPlacements( const LegoBitmap& legoBitmap, const LegoSet& legoSet, const Vec2& pegPos, BrickList& placementsOut ) const
+{
+    placementsOut.clear();
+    
+    int colorIndex = legoBitmap.GetBrickColorIndex( pegPos );
+    Vec2 fitExtent = legoSet.GetFitExtent( pegPos );
+    
+    for( int shapeIndex = 0; shapeIndex < (int)m_shapeIndex.size(); shapeIndex++ )
+    {
+        int defIndex = m_shapeIndex[ shapeIndex ];
+        const Vec2& brickSize = m_brickDefinitions[ defIndex ].m_shape;
         
-        uint64_t searchStepCount = 0;
+        if( brickSize.x > fitExtent.x )
+        {
+            break;
+        }
+        else if( brickSize.y > fitExtent.y )
+        {
+            shapeIndex = m_shapeIndexNextWidth[ shapeIndex ] - 1;
+            continue;
+        }
         
-        while( !workingQueue.empty() )
+        // Every offset of the brick that still has the peg under it
+        for( int y = pegPos.y - brickSize.y + 1; y <= pegPos.y; y++ )
         {
-            // Pop off this lego set and grow it
-            LegoSet legoSet = workingQueue.front();
-            workingQueue.pop_front();
-            
-            Vec2List nextPositions = GetNextPositions( legoSet, legoBitmap, searchStepCount > 0 );
-            
-            // For each 1. Position, 2. Brick type
-            // Note that the color isn't searched; we just sample the position
-            for( int posIndex = 0; posIndex < (int)nextPositions.size(); posIndex++ )
+            for( int x = pegPos.x - brickSize.x + 1; x <= pegPos.x; x++ )
             {
-                const Vec2& nextPosition = nextPositions[ posIndex ];
-                
-                for( int defIndex = 0; defIndex < (int)m_brickDefinitions.size(); defIndex++ )
+                Brick brick( defIndex, colorIndex, Vec2( x, y ) );
+                if( legoSet.CanAddBrick( brick, m_brickDefinitions, legoBitmap ) )
                 {
-                    int colorIndex = legoBitmap.GetBrickColorIndex( nextPosition );
-                    Brick testBrick( defIndex, colorIndex, nextPosition );
-                    LegoSet testSet( legoSet );
-                    
-                    // If valid position, put into queue for further work
-                    searchStepCount++;
-                    if( testSet.AddBrick( testBrick, m_brickDefinitions, legoBitmap ) )
-                    {
-                        if( legoBitmap.GetMosaicPegCount() > 0 )
-                        {
-                            printf( "Progress: %%%.2f, at search depth %d, search count %lld\n", ( float( testSet.GetPlacedPegCount() ) / float( legoBitmap.GetMosaicPegCount() ) ) * 100.0f, (int)testSet.GetBrickList().size(), searchStepCount );
-                        }
-                        
-                        // If valid solution, save it, else push back to queue
-                        if( IsSolved( testSet, legoBitmap ) )
-                        {
-                            solutionList.push_back( testSet );
-                            
-                            printf( "Found a solution; brick-count: %d, cost: $%d.%d\n", (int)testSet.GetBrickList().size(), testSet.GetCost(), testSet.GetCost() % 100 );
-                            
-                            // Draw out this solution; so we can track which solution ID maps to output
-                            if( saveProgress )
-                            {
-                                char fileName[ 512 ];
-                                sprintf( fileName, "LegoMosaicProgress_%05d.png", int( searchStepCount ) );
-                                legoBitmap.SavePng( fileName, m_brickDefinitions, m_brickColors, testSet );
-                            }
-                        }
-                        else
-                        {
-                            workingQueue.push_back( testSet );
-                        }
-                    }
+                    placementsOut.push_back( brick );
                 }
             }
         }
+    }
+    
+    SortPlacements( placementsOut );
+}
+
+void LegoMosaic::GetCanonicalPlacements( const LegoBitmap& legoBitmap, const LegoSet& legoSet, const Vec2& pegPos, BrickList& placementsOut ) const
+{
+    placementsOut.clear();
+    
+    int colorIndex = legoBitmap.GetBrickColorIndex( pegPos );
+    Vec2 freeExtent = legoSet.GetFreeExtent( pegPos );
+    
+    for( int shapeIndex = 0; shapeIndex < (int)m_shapeIndex.size(); shapeIndex++ )
+    {
+        int defIndex = m_shapeIndex[ shapeIndex ];
+        const Vec2& brickSize = m_brickDefinitions[ defIndex ].m_shape;
         
-        // Find best solution based only on price
-        int bestSolutionIndex = -1;
-        int bestSolutionCost = 999999999;
-        
-        for( int i = 0; i < (int)solutionList.size(); i++ )
+        if( brickSize.x > freeExtent.x )
         {
-            int cost = solutionList[ i ].GetCost();
-            if( cost < bestSolutionCost )
-            {
-                bestSolutionCost = cost;
-                bestSolutionIndex = i;
-            }
+            break;
         }
-        
-        if( bestSolutionIndex >= 0 )
+        else if( brickSize.y > freeExtent.y )
         {
-            *m_solutionSet = solutionList[ bestSolutionIndex ];
+            shapeIndex = m_shapeIndexNextWidth[ shapeIndex ] - 1;
+            continue;
         }
-        else
+        
+        Brick brick( defIndex, colorIndex, pegPos );
+        if( legoSet.CanAddBrick( brick, m_brickDefinitions, legoBitmap ) )
         {
-            printf( "Critical error: unable to place a brick into an unsolved set\n" );
-            exit( 0 );
+            placementsOut.push_back( brick );
         }
     }
     
-    // Write out solution
-    if( m_solutionSet != NULL )
+    SortPlacements( placementsOut );
+}
+
+void LegoMosaic::SortPlacements( BrickList& placementsInOut ) const
+{
+    // Cheapest per peg first finds good incumbents early; the rest of the key only makes the order deterministic
+    std::sort( placementsInOut.begin(), placementsInOut.end(), [&]( const Brick& a, const Brick& b )
+        {
+            const BrickDefinition& defA = m_brickDefinitions[ a.m_definitionId ];
+            const BrickDefinition& defB = m_brickDefinitions[ b.m_definitionId ];
+            int costA = defA.m_cost * defB.m_shape.x * defB.m_shape.y;
+            int costB = defB.m_cost * defA.m_shape.x * defA.m_shape.y;
+            if( costA != costB ) return costA < costB;
+            if( a.m_definitionId != b.m_definitionId ) return a.m_definitionId < b.m_definitionId;
+            if( a.m_position.y != b.m_position.y ) return a.m_position.y < b.m_position.y;
+            return a.m_position.x < b.m_position.x;
+        }
+    );
+}
+
+void LegoMosaic::ReportProgress( const LegoBitmap& legoBitmap, const LegoSet& legoSet, const SolverSettings& settings )
+{
+    // Show progress: write it out to memory
+    int searchDepth = (int)legoSet.GetBrickList().size();
+    
+    if( settings.m_saveProgress )
     {
-        legoBitmap.SavePng( "LegoMosaicProgress_Result.png", m_brickDefinitions, m_brickColors, *m_solutionSet );
+        char fileName[ 512 ];
+        sprintf( fileName, "LegoMosaicProgress_%05d.png", searchDepth );
+        legoBitmap.SavePng( fileName, m_brickDefinitions, m_brickColors, legoSet );
     }
     
-    // 3. Print parts list, with price; deffers to PrintSolution(...)
-    
+    if( settings.m_printProgress && legoBitmap.GetMosaicPegCount() > 0 )
+    {
+        printf( "Progress: %%%.2f, at search depth %d\n", ( float( legoSet.GetPlacedPegCount() ) / float( legoBitmap.GetMosaicPegCount() ) * 100.0f ), searchDepth );
+    }
 }
 
 void LegoMosaic::PrintSolution( const std::vector< char* > brickColorNames )
@@ -368,86 +2362,45 @@ void LegoMosaic::PrintSolution( const std::vector< char* > brickColorNames )
 
 Vec2List LegoMosaic::GetNextPositions( const LegoSet& legoSet, const LegoBitmap& legoBitmap, bool onlyAppend  )
 {
-    // This is a bit expensive: basically we're doing edge-detection, where a pixel on an unplaced peg,
-    // if it is directly adjacent to a placed lego piece *or* image edge, is pushed to this list and returned
+    // The set keeps its frontier (uncovered pegs next to a placed brick, empty pixel or image edge) up to date,
+    // so all that's left is to filter and put it back into board scan order, which keeps the search deterministic
+    const Vec2List& frontier = legoSet.GetFrontier();
+    const Vec2& boardSize = legoBitmap.GetBoardSize();
     
-	// Basically do edge-detection
-	Vec2List edgePositions;
-	
-	// Up, down, left, right offsets
-	static const Vec2 cOffsets[ 4 ] =
-    {
-        Vec2( 0, -1 ),
-        Vec2( 0, 1 ),
-        Vec2(-1, 0 ),
-        Vec2( 1, 0 ),
-	};
+    Vec2List edgePositions;
+    edgePositions.reserve( frontier.size() );
     
-    // For each peg on the board
-	IterateBoard( [&](Vec2 pos)
+    for( int i = 0; i < (int)frontier.size(); i++ )
+    {
+        const Vec2& pos = frontier[ i ];
+        
+        // Only test if adjacent to other Lego bricks
+        if( onlyAppend )
         {
-            // Ignore if the current spot is already occupied in the set *or* is an invalid color
-            if( legoSet.IsPegOccupied( pos ) || legoBitmap.GetBrickColorIndex( pos ) < 0 )
-            {
-                return;
-            }
-            
-            // Now check the neighboring positions for these states...
-            for( int i = 0; i < 4; i++ )
+            bool pegOccupied = ( pos.y > 0 && legoSet.IsPegOccupied( Vec2( pos.x, pos.y - 1 ) ) ) ||
+                               ( pos.y < boardSize.y - 1 && legoSet.IsPegOccupied( Vec2( pos.x, pos.y + 1 ) ) ) ||
+                               ( pos.x > 0 && legoSet.IsPegOccupied( Vec2( pos.x - 1, pos.y ) ) ) ||
+                               ( pos.x < boardSize.x - 1 && legoSet.IsPegOccupied( Vec2( pos.x + 1, pos.y ) ) );
+            if( !pegOccupied )
             {
-                Vec2 adjPos( pos.x + cOffsets[ i ].x, pos.y + cOffsets[ i ].y );
-                
-                bool inBoard = adjPos.x >= 0 && adjPos.y >= 0 && adjPos.x < m_boardSize.x && adjPos.y < m_boardSize.y;
-                bool pegOccupied = inBoard && legoSet.IsPegOccupied( adjPos );
-                bool pegHasColor = inBoard && legoBitmap.GetBrickColorIndex( adjPos ) < 0;
-                
-                // Only test if adjacent to other Lego bricks
-                if( onlyAppend && pegOccupied )
-                {
-                    // Save and stop searching
-                    edgePositions.push_back( pos );
-                    return;
-                }
-                
-                // Only test if adjacent to other Lego bricks or next to an empty pixel
-                else if( !onlyAppend && ( !inBoard || pegOccupied || pegHasColor ) )
-                {
-                    // Save and stop searching
-                    edgePositions.push_back( pos );
-                    return;
-                }
+                continue;
             }
         }
-    );
-    
-	return edgePositions;
-}
-
-bool LegoMosaic::IsSolved( const LegoSet& legoSet, const LegoBitmap& legoBitmap )
-{
-    bool isFilled = (legoSet.GetBrickList().size() > 0);
+        
+        edgePositions.push_back( pos );
+    }
     
-    IterateBoard( [&](Vec2 pos)
+    std::sort( edgePositions.begin(), edgePositions.end(), [](const Vec2& a, const Vec2& b)
         {
-            // If there is a color and it isn't occupied by a lego piece, flag as bad
-            if( legoBitmap.GetBrickColorIndex( pos ) > 0 && legoSet.IsPegOccupied( pos ) == false )
-            {
-                isFilled = false;
-            }
+            return ( a.y < b.y ) || ( a.y == b.y && a.x < b.x );
         }
     );
     
-    return isFilled;
+	return edgePositions;
 }
 
-void LegoMosaic::IterateBoard( std::function< void(Vec2) > func )
+bool LegoMosaic::IsSolved( const LegoSet& legoSet, const LegoBitmap& )
 {
-	// Go through the array
-	for( int y = 0; y < m_boardSize.y; y++ )
-	{
-		for( int x = 0; x < m_boardSize.x; x++ )
-		{
-			func( Vec2( x, y ) );
-		}
-	}
+    // Uncovered pegs are counted down as bricks are placed
+    return legoSet.IsSolved();
 }
@@ -6,20 +6,137 @@
  Description: Solves for a given image, converting it first into
  a mosaic image that matches (based on euclidian distance of each
  pixel's RGB value compared to the given list of RGB brick-color
- valies), then fills the set using a non-recursive A* search algorithm.
- Though the solving function is not recursive, the internal data
- structures allow stepping back to solve for global correctness.
- You can explicitly turn this on (it's essentially a global brute-
- force strategy) by passing true as a second argument to the
- Solve function.
+ valies), then fills the set with one of the search engines listed
+ in SolverType: greedy placement of the best-ranked brick by
+ default, or an exhaustive, exact or best-first (A*) search. The
+ engine and its knobs are picked through the SolverSettings given
+ to Solve(...).
  
  ***/
 
 #ifndef __LEGOMOSAIC_H__
 #define __LEGOMOSAIC_H__
 
+#include <memory>
+#include <mutex>
+#include <string>
+
 #include "LegoBitmap.h"
 #include "LegoSet.h"
+#include "ThreadPool.h"
+#include "Cancellation.h"
+#include "TranspositionTable.h"
+#include "RectPartition.h"
+#include "TilingTable.h"
+
+// Search engines that Solve(...) can run
+enum SolverType
+{
+    SolverType_Greedy = 0,      // Place the best-ranked brick on the frontier, one full pass per brick (default)
+    SolverType_GreedyQueue,     // Same choices as greedy, but scored candidates are kept in a heap across passes
+    SolverType_BruteForce,      // Depth-first exhaustive search; only practical on tiny images
+    SolverType_BranchAndBound,  // Exact depth-first branch and bound on boards up to m_exactPegLimit pegs, greedy on larger ones
+    SolverType_AStar,           // Best-first search on cost plus a cost lower bound; optimal within budget, else greedy completion
+    SolverType_Beam,            // Greedy over the m_beamWidth best partial sets at once; a width of one is plain greedy
+    SolverType_Scanline,        // Single streaming pass in scan order, cheapest-per-peg brick that fits; linear time, for huge boards
+    SolverType_MaxRect,         // Repeatedly covers the largest free same-color rectangle; fast, close to greedy on blocky art
+    SolverType_Partition,       // Splits each same-color region into the fewest rectangles, then covers each rectangle
+};
+
+// Everything that changes how Solve(...) runs
+struct SolverSettings
+{
+    SolverSettings()
+        : m_solverType( SolverType_Greedy )
+        , m_saveProgress( false )
+        , m_printProgress( true )
+        , m_useThreading( true )
+        , m_dither( false )
+        , m_batchSize( 1 )
+        , m_useRegions( false )
+        , m_exactPegLimit( 32 )
+        , m_searchNodeBudget( 100000 )
+        , m_searchMemoryBudget( 256 )
+        , m_beamWidth( 8 )
+        , m_timeLimit( 0.0 )
+        , m_publishSolutions( true )
+        , m_mergeBricks( false )
+        , m_improveRounds( 0 )
+        , m_windowSize( 0 )
+        , m_seed( 1 )
+        , m_randomizeTies( false )
+        , m_usePortfolio( false )
+        , m_coarseToFine( false )
+        , m_tilingCacheDirectory( "" )
+    {
+    }
+    
+    SolverType m_solverType;
+    bool m_saveProgress;    // Write out a png per placed brick
+    bool m_printProgress;   // Print a line per placed brick
+    bool m_useThreading;    // Evaluate candidates on all cores; note that brute-force doesn't use threading
+    bool m_dither;          // Dither colors when converting the image to brick colors
+    
+    // Greedy only: up to this many non-overlapping bricks are committed per evaluation pass, best first
+    // One is the classic greedy; larger batches cut the number of passes at some loss of quality
+    int m_batchSize;
+    
+    // Split the board into same-color regions and solve each one on its own, in parallel, largest first
+    // Any engine works per region; progress is only reported once the regions are merged back together
+    bool m_useRegions;
+    
+    // Branch and bound only: largest board (or region, which is where this is useful) that is solved exactly
+    int m_exactPegLimit;
+    
+    // A* only: states expanded before giving up on optimality
+    // The best open state is then finished with greedy, and the gap to the proven lower bound is reported
+    int m_searchNodeBudget;
+    
+    // Hard cap, in megabytes, on the partial sets held by A* and beam search
+    int m_searchMemoryBudget;
+    
+    // Beam only: partial sets kept per step; cost (and CPU time) of the result goes down (and up) with it
+    int m_beamWidth;
+    
+    // Wall-clock budget of the whole solve, in seconds; zero (or less) is unbounded
+    // Engines stop at the next check once it runs out, and Solve(...) returns the best set found by then
+    double m_timeLimit;
+    
+    // Optional token to cancel a running solve from another thread; Solve(...) makes its own if none is given
+    std::shared_ptr< CancellationToken > m_cancellation;
+    
+    // Engines hand every improved complete set to GetBestSolution(...); off for the engines run on region boards
+    bool m_publishSolutions;
+    
+    // Opt-in post-pass on the final set: same-color bricks that exactly tile a cheaper catalog shape are swapped for it
+    // Off by default, so the engines' own results (and the exact engines' optimal ones) come back as found
+    bool m_mergeBricks;
+    
+    // Large neighborhood search on the solved set: each round tiles the board with windows (at a random offset), rips
+    // out the bricks inside each window and re-solves the hole, keeping it if it got cheaper; windows are repaired in parallel
+    // Holes up to m_exactPegLimit pegs are solved exactly, larger ones with greedy; zero rounds turns this off
+    int m_improveRounds;
+    
+    // Window side in pegs; zero picks the largest square window whose holes all fit under m_exactPegLimit
+    int m_windowSize;
+    
+    // Seeds everything random in a solve; the same seed and settings give the same result, threaded or not
+    unsigned int m_seed;
+    
+    // Greedy only: bricks of equal rank are committed in a seeded random order instead of scan order
+    bool m_randomizeTies;
+    
+    // Race a fixed portfolio of engine configurations (and seeds) on the pool, under the same time limit, keeping the cheapest
+    bool m_usePortfolio;
+    
+    // Before the engine runs, cover large same-color areas with rectangles of uniform 2^k x 2^k blocks, biggest blocks
+    // first; the engine then only has the ragged leftovers to fill. Works per region too
+    bool m_coarseToFine;
+    
+    // If set, the rectangle tiling table for this brick catalog is loaded from and saved to this directory, so later runs
+    // (and other images) start with it filled in
+    std::string m_tilingCacheDirectory;
+};
 
 class LegoMosaic
 {
@@ -30,8 +147,18 @@ public:
     LegoMosaic( const BrickDefinitionList& brickDefinitions, const BrickColorList& brickColors );
     ~LegoMosaic();
     
-    // Solve, doing an A* search algorithm; note that brute-force doesn't use threading
-    void Solve( const char* fileName, bool saveProgress = false, bool useBruteForce = false, bool useThreading = true, bool dither = false );
+    // Solve with the engine picked in the settings (greedy by default)
+    // Threading uses a worker pool that lives as long as this object; without it candidates are evaluated inline
+    // If cancelled or out of time, returns the cheapest complete set found so far, or the partial set finished quickly
+    // Returns false if the image can't be covered at all
+    bool Solve( const char* fileName, const SolverSettings& settings = SolverSettings() );
+    
+    // Copies out the cheapest complete set published by the running (or last) solve; false if there is none yet
+    // Safe to call from another thread while Solve(...) runs
+    bool GetBestSolution( LegoSet& legoSetOut );
+    
+    // Name of the portfolio configuration that produced the last solution; empty if the portfolio wasn't used
+    const std::string& GetPortfolioWinner() const { return m_portfolioWinner; }
     
     // Print the purchase order / parts list
     void PrintSolution( const std::vector< char* > brickColorNames );
@@ -45,19 +172,152 @@ protected:
     // Returns true if all colors are covered by bricks
     bool IsSolved( const LegoSet& legoSet, const LegoBitmap& legoBitmap );
     
-    // Helpful for drawing / pixel parsing
-    void IterateBoard( std::function< void(Vec2) > func );
+    // Runs the engine picked in the settings, on the whole board or region by region
+    bool RunSolver( const std::shared_ptr< const LegoBitmap >& bitmapView, LegoSet& legoSetInOut, const SolverSettings& settings );
+    
+    // Solves each same-color region on its own small board, then merges the bricks back into the given set
+    // Regions are handed out to the workers largest first; each region's engine runs single-threaded
+    bool SolveRegions( const std::shared_ptr< const LegoBitmap >& bitmapView, LegoSet& legoSetInOut, const SolverSettings& settings );
+    
+    // Runs every configuration of the portfolio as its own task, each single-threaded on the shared bitmap
+    // Every one is taken to a complete set (quickly finished if out of time) and the cheapest wins; ties go to the earlier one
+    bool SolvePortfolio( const std::shared_ptr< const LegoBitmap >& bitmapView, LegoSet& legoSetInOut, const SolverSettings& settings );
+    
+    // Search engines; each one adds bricks to the given set until it is solved, returns false if it gets stuck
+    // Once the settings' token is cancelled they stop early, leaving their best (possibly partial) set in the given set
+    bool SolveGreedy( const std::shared_ptr< const LegoBitmap >& bitmapView, LegoSet& legoSetInOut, const SolverSettings& settings );
+    bool SolveGreedyQueue( const LegoBitmap& legoBitmap, LegoSet& legoSet, const SolverSettings& settings );
+    bool SolveBruteForce( const LegoBitmap& legoBitmap, LegoSet& legoSetInOut, const SolverSettings& settings );
+    bool SolveBranchAndBound( const std::shared_ptr< const LegoBitmap >& bitmapView, LegoSet& legoSetInOut, const SolverSettings& settings );
+    
+    bool SolveAStar( const std::shared_ptr< const LegoBitmap >& bitmapView, LegoSet& legoSetInOut, const SolverSettings& settings );
+    bool SolveBeam( const std::shared_ptr< const LegoBitmap >& bitmapView, LegoSet& legoSetInOut, const SolverSettings& settings );
+    
+    // Coarse pass of m_coarseToFine: builds a pyramid of uniform-color blocks from the board, then from the coarsest level
+    // down, joins free uniform blocks of one color into rectangles and covers each with CoverRectangle(...)
+    // Returns the number of bricks placed, or -1 if one of them was rejected by the set
+    int PlaceCoarseBlocks( const LegoBitmap& legoBitmap, LegoSet& legoSetInOut );
+    
+    // Appends bricks that exactly cover the given rectangle in one color, looked up in m_tilingTable; the table holds the
+    // cheapest guillotine tiling per size, so every engine (and region, and solve) shares the same work
+    // Returns false if the rectangle can't be covered (a catalog without a 1x1)
+    bool CoverRectangle( const Vec2& origin, const Vec2& size, int colorIndex, BrickList& bricksOut ) const;
+    
+    // Finds the largest free same-color rectangle with a histogram / stack pass per row over run-up lengths, covers it
+    // with CoverRectangle(...), and repeats; each row's best is kept in a heap, and only the rows whose run-ups changed
+    // are rescanned (their old heap entries are left in place and skipped once stale)
+    bool SolveMaxRect( const LegoBitmap& legoBitmap, LegoSet& legoSetInOut, const SolverSettings& settings );
+    
+    // Two stages: every same-color region's free pegs are split into the fewest rectangles (see RectPartition.h), then
+    // each rectangle is covered with CoverRectangle(...); no search, so the time only depends on the regions' shapes
+    bool SolvePartition( const LegoBitmap& legoBitmap, LegoSet& legoSetInOut, const SolverSettings& settings );
+    
+    // Walks the board row by row, anchoring at each uncovered peg the cheapest-per-peg brick that fits the same-color
+    // run there, as far down as the color agrees; only the rows a brick can reach are kept, and the set is built once at the end
+    bool SolveScanline( const LegoBitmap& legoBitmap, LegoSet& legoSetInOut, const SolverSettings& settings );
+    
+    // State of a depth-first exact search, shared by every level of the recursion
+    struct ExactSearch
+    {
+        ExactSearch( const LegoSet& startSet, size_t maxTableEntries )
+            : m_bestSet( startSet )
+            , m_found( false )
+            , m_nodeCount( 0 )
+            , m_cancelled( false )
+            , m_transpositions( maxTableEntries )
+        {
+        }
+        
+        // Incumbent: the cheapest complete set found so far; only valid if m_found
+        LegoSet m_bestSet;
+        bool m_found;
+        
+        uint64_t m_nodeCount;
+        
+        // Set once the token is seen cancelled; every level then returns right away
+        bool m_cancelled;
+        
+        TranspositionTable m_transpositions;
+        
+        // Candidate placements of each depth, reused between siblings
+        std::vector< BrickList > m_placementStack;
+    };
+    
+    // Depth-first steps of the exact searches; they grow the given set in place and take every brick back before returning
+    // Both skip coverages already searched at no higher cost; branch and bound also cuts anything that can't beat the incumbent
+    void BruteForce( const LegoBitmap& legoBitmap, LegoSet& legoSet, ExactSearch& search, const SolverSettings& settings, const Vec2& startPeg );
+    void BranchAndBound( const LegoBitmap& legoBitmap, LegoSet& legoSet, ExactSearch& search, const SolverSettings& settings );
+    
+    // Polls the settings' token; exact searches only do so every so many nodes, so this stays off their hot path
+    bool IsCancelled( const SolverSettings& settings ) const;
+    bool IsCancelled( ExactSearch& search, const SolverSettings& settings ) const;
+    
+    // Quick completion of a partial set: each uncovered peg, in scan order, gets the cheapest-per-peg brick
+    // anchored on it that fits; used when a solve runs out of time before it had a complete set
+    bool FillUncovered( const LegoBitmap& legoBitmap, LegoSet& legoSetInOut ) const;
+    
+    // Replaces groups of same-color bricks whose union is exactly the footprint of a cheaper definition, until no
+    // such group is left; a peg-to-brick index keeps each pass linear in the brick count. Returns the pennies saved
+    int MergeBricks( const LegoBitmap& legoBitmap, LegoSet& legoSetInOut ) const;
+    
+    // Large neighborhood search rounds (see m_improveRounds) on a solved set; returns the pennies saved
+    int ImproveSolution( const std::shared_ptr< const LegoBitmap >& bitmapView, LegoSet& legoSetInOut, const SolverSettings& settings );
+    
+    // Keeps the given set for GetBestSolution(...) if it is complete and cheaper than what was published before
+    void PublishSolution( const LegoSet& legoSet, const SolverSettings& settings );
+    
+    // Admissible bound on the cost of any solution grown from this set: every uncovered peg costs at least the best cost-per-peg
+    int GetCostLowerBound( const LegoSet& legoSet ) const;
+    
+    // Exact searches branch on one frontier peg: the most constrained (smallest fit), ties in scan order; false if there is none
+    bool GetBranchPeg( const LegoSet& legoSet, Vec2& pegOut ) const;
+    
+    // Every placement that covers the given uncovered peg and fits the set as it is, cheapest cost-per-peg first
+    void GetCoveringPlacements( const LegoBitmap& legoBitmap, const LegoSet& legoSet, const Vec2& pegPos, BrickList& placementsOut ) const;
+    
+    // Only the placements with their top-left corner on the peg, cheapest cost-per-peg first
+    // Branching on the first uncovered peg in scan order with these (exact-cover order) generates every tiling exactly once
+    void GetCanonicalPlacements( const LegoBitmap& legoBitmap, const LegoSet& legoSet, const Vec2& pegPos, BrickList& placementsOut ) const;
+    
+    // Cheapest cost-per-peg first, then by definition and position
+    void SortPlacements( BrickList& placementsInOut ) const;
+    
+    // Scores every placement around the given positions, returning the best candidate of each (invalid if none fit)
+    // Runs on the thread pool if the settings allow it
+    void EvaluatePositions( const std::shared_ptr< const LegoBitmap >& bitmapView, const std::shared_ptr< const LegoSet >& setView, const Vec2List& positions, const SolverSettings& settings, std::vector< BrickCandidate >& positionBestsOut );
+    
+    // Prints and / or saves the current state, as asked for in the settings
+    void ReportProgress( const LegoBitmap& legoBitmap, const LegoSet& legoSet, const SolverSettings& settings );
     
 private:
     
     BrickDefinitionList m_brickDefinitions;
     BrickColorList m_brickColors;
     
+    // Definition indices sorted by shape (width, then height); m_shapeIndexNextWidth[ i ] is where the next width starts
+    std::vector< int > m_shapeIndex;
+    std::vector< int > m_shapeIndexNextWidth;
+    
+    // Lowest cost (in pennies) per peg over all definitions; used for cost lower bounds
+    float m_bestCostPerPeg;
+    
     Vec2 m_boardSize;
     Vec2List m_legalPositions;
     
     LegoSet* m_solutionSet;
     
+    // Cheapest complete set published during the current solve; guarded by the mutex, since readers may be on other threads
+    std::mutex m_publishMutex;
+    std::shared_ptr< LegoSet > m_publishedSet;
+    
+    std::string m_portfolioWinner;
+    
+    // Worker pool for candidate evaluation; a single worker when threading is off
+    ThreadPool* m_threadPool;
+    
+    // Cheapest tiling per rectangle size for m_brickDefinitions; filled on demand, kept across solves
+    TilingTable* m_tilingTable;
+    
 };
 
 #endif // __LEGOMOSAIC_H__
@@ -8,15 +8,26 @@
 #include "LegoSet.h"
 
 #include "LegoBitmap.h"
+#include "Zobrist.h"
 
-LegoSet::LegoSet( const Vec2& boardSize, const BrickList& bricks, const BrickDefinitionList& brickDefinitions )
-    : m_boardSize( boardSize )
+#include <assert.h>
+
+LegoSet::LegoSet( const LegoBitmap& legoBitmap, const BrickList& bricks, const BrickDefinitionList& brickDefinitions )
+    : m_boardSize( legoBitmap.GetBoardSize() )
     , m_brickList( bricks )
+    , m_rowWordCount( BitRowWordCount( legoBitmap.GetBoardSize().x ) )
     , m_cost( 0 )
     , m_pegCount( 0 )
+    , m_uncoveredPegCount( legoBitmap.GetMosaicPegCount() )
+    , m_placementHash( 0 )
+    , m_coverageHash( 0 )
 {
+    // Run lengths would wrap past this; ConvertMosaic(...) never hands out such a board
+    assert( m_boardSize.x <= cMaxBoardSide && m_boardSize.y <= cMaxBoardSide );
+    
 	// Allocate needed map, default to un-filled
-	m_boardOccupancy.resize( m_boardSize.x * m_boardSize.y, false );
+	m_occupancyRows.resize( m_boardSize.y * m_rowWordCount, 0 );
+    m_frontierSlots.resize( m_boardSize.x * m_boardSize.y, -1 );
     
 	// Add given bricks, don't do a deep copy since we need to setup the board
 	const int brickCount = (int)bricks.size();
@@ -26,20 +37,57 @@ LegoSet::LegoSet( const Vec2& boardSize, const BrickList& bricks, const BrickDef
         const BrickDefinition& brickDefinition = brickDefinitions[ brick.m_definitionId ];
         IterateBrick( m_brickList[ i ].m_position, brickDefinition.m_shape, [&](Vec2 pos)
             {
-                int pegIndex = pos.y * m_boardSize.x + pos.x;
-                m_boardOccupancy[ pegIndex ] = true;
+                BitRowFill( &m_occupancyRows[ pos.y * m_rowWordCount ], pos.x, 1, true );
+                m_uncoveredPegCount--;
+                m_coverageHash ^= ZobristPegKey( pos.y * m_boardSize.x + pos.x );
             }
         );
+        
+        m_placementHash ^= ZobristPlacementKey( brick.m_definitionId, brick.m_colorId, brick.m_position );
+        m_cost += brickDefinition.m_cost;
+        m_pegCount += brickDefinition.m_shape.x * brickDefinition.m_shape.y;
 	}
+    
+    // Run tables are built over the whole board once, then refreshed around each brick
+    m_runLeft.resize( m_boardSize.x * m_boardSize.y, 0 );
+    m_runRight.resize( m_boardSize.x * m_boardSize.y, 0 );
+    m_runUp.resize( m_boardSize.x * m_boardSize.y, 0 );
+    m_runDown.resize( m_boardSize.x * m_boardSize.y, 0 );
+    RefreshRuns( Vec2( 0, 0 ), m_boardSize, legoBitmap );
+    
+    // Seed the frontier with a single full scan; from here on AddBrick(...) only touches the area around a new brick
+    for( int y = 0; y < m_boardSize.y; y++ )
+    {
+        for( int x = 0; x < m_boardSize.x; x++ )
+        {
+            Vec2 pos( x, y );
+            if( IsFrontierPeg( pos, legoBitmap ) )
+            {
+                AddFrontierPeg( pos );
+            }
+        }
+    }
 }
 
 LegoSet::LegoSet( const LegoSet& legoSet )
 {
 	m_boardSize = legoSet.m_boardSize;
 	m_brickList = legoSet.m_brickList;
-	m_boardOccupancy = legoSet.m_boardOccupancy;
+	m_occupancyRows = legoSet.m_occupancyRows;
+    m_rowWordCount = legoSet.m_rowWordCount;
+    m_frontier = legoSet.m_frontier;
+    m_frontierSlots = legoSet.m_frontierSlots;
+    m_undoRecords = legoSet.m_undoRecords;
+    m_undoPegs = legoSet.m_undoPegs;
+    m_runLeft = legoSet.m_runLeft;
+    m_runRight = legoSet.m_runRight;
+    m_runUp = legoSet.m_runUp;
+    m_runDown = legoSet.m_runDown;
 	m_cost = legoSet.m_cost;
     m_pegCount = legoSet.m_pegCount;
+    m_uncoveredPegCount = legoSet.m_uncoveredPegCount;
+    m_placementHash = legoSet.m_placementHash;
+    m_coverageHash = legoSet.m_coverageHash;
 }
 
 LegoSet::~LegoSet()
@@ -47,7 +95,7 @@ LegoSet::~LegoSet()
 	// ...
 }
 
-bool LegoSet::AddBrick( const Brick& brick, const BrickDefinitionList& brickDefinitions, const LegoBitmap& legoBitmap )
+bool LegoSet::CanAddBrick( const Brick& brick, const BrickDefinitionList& brickDefinitions, const LegoBitmap& legoBitmap ) const
 {
     // Get brick size
     const BrickDefinition& brickDefinition = brickDefinitions[ brick.m_definitionId ];
@@ -68,22 +116,67 @@ bool LegoSet::AddBrick( const Brick& brick, const BrickDefinitionList& brickDefi
         return false;
     }
     
-	// Color and bounds matching
-	bool fail = false;
-	IterateBrick( brick.m_position, brickSize, [&](Vec2 pos)
+    // Quick reject: the top-left peg's runs must be long enough to hold the brick
+    int cornerIndex = brick.m_position.y * m_boardSize.x + brick.m_position.x;
+    if( m_runRight[ cornerIndex ] < brickSize.x || m_runDown[ cornerIndex ] < brickSize.y )
+    {
+        return false;
+    }
+    
+	// Color must match and must not intersect existing bricks: per row, the span must be all-color and no-occupancy,
+    // tested up to 64 pegs at a time; bail on the first bad row
+    for( int y = brick.m_position.y; y < brick.m_position.y + brickSize.y; y++ )
+    {
+        const uint64_t* occupancyRow = &m_occupancyRows[ y * m_rowWordCount ];
+        const uint64_t* colorRow = legoBitmap.GetColorRow( brickColorIndex, y );
+        if( colorRow == NULL )
         {
-            // Color must match; if we go out of bounds, the color is -1 (so we can fail out early)
-            // Must also not intersect existing bricks
-            bool alreadyOccupied = IsPegOccupied( pos );
-            bool differentColor = legoBitmap.GetBrickColorIndex( pos ) != brickColorIndex;
-            fail |= alreadyOccupied || differentColor; // Note the "|=", very important!
+            return false;
         }
-    );
-	
-	if( fail )
-	{
-		return false;
-	}
+        
+        for( int x = brick.m_position.x, remaining = brickSize.x; remaining > 0; )
+        {
+            int span = ( remaining < 64 ) ? remaining : 64;
+            uint64_t freeBits = BitRowExtract( colorRow, x, span ) & ~BitRowExtract( occupancyRow, x, span );
+            if( freeBits != BitRowMask( span ) )
+            {
+                return false;
+            }
+            
+            x += span;
+            remaining -= span;
+        }
+    }
+    
+    return true;
+}
+
+bool LegoSet::ScoreBrick( const Brick& brick, const BrickDefinitionList& brickDefinitions, const LegoBitmap& legoBitmap, float& rankDeltaOut ) const
+{
+    if( !CanAddBrick( brick, brickDefinitions, legoBitmap ) )
+    {
+        return false;
+    }
+    
+    // Same formula as GetRank(), as if the brick was already in the list
+    const BrickDefinition& brickDefinition = brickDefinitions[ brick.m_definitionId ];
+    int pegCount = m_pegCount + brickDefinition.m_shape.x * brickDefinition.m_shape.y;
+    int cost = m_cost + brickDefinition.m_cost;
+    float rank = - ( float( pegCount ) / float( m_brickList.size() + 1 ) ) * 100.0f - float( cost );
+    
+    rankDeltaOut = rank - GetRank();
+    return true;
+}
+
+bool LegoSet::AddBrick( const Brick& brick, const BrickDefinitionList& brickDefinitions, const LegoBitmap& legoBitmap )
+{
+    if( !CanAddBrick( brick, brickDefinitions, legoBitmap ) )
+    {
+        return false;
+    }
+    
+    const BrickDefinition& brickDefinition = brickDefinitions[ brick.m_definitionId ];
+    Vec2 brickSize = brickDefinition.m_shape;
     
 	// Good to place, just append to list, and write to buffer
 	m_brickList.push_back( brick );
@@ -92,22 +185,255 @@ bool LegoSet::AddBrick( const Brick& brick, const BrickDefinitionList& brickDefi
 	m_cost += brickDefinition.m_cost;
     m_pegCount += brickDefinition.m_shape.x * brickDefinition.m_shape.y;
 	
+	for( int y = brick.m_position.y; y < brick.m_position.y + brickSize.y; y++ )
+    {
+        BitRowFill( &m_occupancyRows[ y * m_rowWordCount ], brick.m_position.x, brickSize.x, true );
+    }
+    UndoRecord undoRecord = { (int)m_undoPegs.size(), 0 };
 	IterateBrick( brick.m_position, brickSize, [&](Vec2 pos)
         {
-            if( m_boardOccupancy[ pos.y * m_boardSize.x + pos.x ] == true )
-                printf( "Inconsistency problem!!" );
-            m_boardOccupancy[ pos.y * m_boardSize.x + pos.x ] = true;
+            if( m_frontierSlots[ pos.y * m_boardSize.x + pos.x ] >= 0 )
+            {
+                RemoveFrontierPeg( pos );
+                m_undoPegs.push_back( pos );
+                undoRecord.m_removedCount++;
+            }
+            m_coverageHash ^= ZobristPegKey( pos.y * m_boardSize.x + pos.x );
         }
     );
+    m_undoRecords.push_back( undoRecord );
+    m_placementHash ^= ZobristPlacementKey( brick.m_definitionId, brick.m_colorId, brick.m_position );
+    m_uncoveredPegCount -= brickDefinition.m_shape.x * brickDefinition.m_shape.y;
+    RefreshRuns( brick.m_position, brickSize, legoBitmap );
+    
+    // Only the ring of pegs directly around the brick can join the frontier
+    for( int x = brick.m_position.x; x < brick.m_position.x + brickSize.x; x++ )
+    {
+        Vec2 topPos( x, brick.m_position.y - 1 );
+        Vec2 bottomPos( x, brick.m_position.y + brickSize.y );
+        AddFrontierPegLogged( topPos, legoBitmap );
+        AddFrontierPegLogged( bottomPos, legoBitmap );
+    }
+    for( int y = brick.m_position.y; y < brick.m_position.y + brickSize.y; y++ )
+    {
+        Vec2 leftPos( brick.m_position.x - 1, y );
+        Vec2 rightPos( brick.m_position.x + brickSize.x, y );
+        AddFrontierPegLogged( leftPos, legoBitmap );
+        AddFrontierPegLogged( rightPos, legoBitmap );
+    }
     
 	// All done!
 	return true;
 }
 
-bool LegoSet::IsPegOccupied( const Vec2& pos ) const
+bool LegoSet::RemoveLastBrick( const BrickDefinitionList& brickDefinitions, const LegoBitmap& legoBitmap )
 {
+    if( m_undoRecords.empty() )
+    {
+        return false;
+    }
+    
+    const Brick brick = m_brickList.back();
+    const BrickDefinition& brickDefinition = brickDefinitions[ brick.m_definitionId ];
+    Vec2 brickSize = brickDefinition.m_shape;
+    UndoRecord undoRecord = m_undoRecords.back();
+    
+    m_brickList.pop_back();
+    m_undoRecords.pop_back();
+    
+    m_cost -= brickDefinition.m_cost;
+    m_pegCount -= brickSize.x * brickSize.y;
+    m_uncoveredPegCount += brickSize.x * brickSize.y;
+    m_placementHash ^= ZobristPlacementKey( brick.m_definitionId, brick.m_colorId, brick.m_position );
+    
+    // Reverse of AddBrick(...): drop the ring pegs it added, uncover, then put back the pegs it took off the frontier
+    for( int i = (int)m_undoPegs.size() - 1; i >= undoRecord.m_pegStart + undoRecord.m_removedCount; i-- )
+    {
+        RemoveFrontierPeg( m_undoPegs[ i ] );
+    }
+    
+	for( int y = brick.m_position.y; y < brick.m_position.y + brickSize.y; y++ )
+    {
+        BitRowFill( &m_occupancyRows[ y * m_rowWordCount ], brick.m_position.x, brickSize.x, false );
+    }
+	IterateBrick( brick.m_position, brickSize, [&](Vec2 pos)
+        {
+            m_coverageHash ^= ZobristPegKey( pos.y * m_boardSize.x + pos.x );
+        }
+    );
+    RefreshRuns( brick.m_position, brickSize, legoBitmap );
+    
+    for( int i = undoRecord.m_pegStart; i < undoRecord.m_pegStart + undoRecord.m_removedCount; i++ )
+    {
+        AddFrontierPeg( m_undoPegs[ i ] );
+    }
+    m_undoPegs.resize( undoRecord.m_pegStart );
+    
+    return true;
+}
+
+void LegoSet::UndoToCheckpoint( int checkpoint, const BrickDefinitionList& brickDefinitions, const LegoBitmap& legoBitmap )
+{
+    while( (int)m_brickList.size() > checkpoint && RemoveLastBrick( brickDefinitions, legoBitmap ) )
+    {
+    }
+}
+
+bool LegoSet::GetFirstUncoveredPeg( const LegoBitmap& legoBitmap, const Vec2& startPos, Vec2& pegOut ) const
+{
+    // A word at a time: colored and not occupied
+    for( int y = startPos.y; y < m_boardSize.y; y++ )
+    {
+        const uint64_t* coloredRow = legoBitmap.GetColoredRow( y );
+        const uint64_t* occupancyRow = &m_occupancyRows[ y * m_rowWordCount ];
+        
+        int word = ( y == startPos.y ) ? ( startPos.x >> 6 ) : 0;
+        for( ; word < m_rowWordCount; word++ )
+        {
+            uint64_t bits = coloredRow[ word ] & ~occupancyRow[ word ];
+            if( y == startPos.y && word == ( startPos.x >> 6 ) )
+            {
+                bits &= ~uint64_t( 0 ) << ( startPos.x & 63 );
+            }
+            
+            if( bits != 0 )
+            {
+                pegOut = Vec2( word * 64 + BitRowLowestBit( bits ), y );
+                return true;
+            }
+        }
+    }
+    
+    return false;
+}
+
+size_t LegoSet::GetMemoryUsage() const
+{
+    return sizeof( LegoSet ) +
+           m_brickList.capacity() * sizeof( Brick ) +
+           m_occupancyRows.capacity() * sizeof( uint64_t ) +
+           m_frontier.capacity() * sizeof( Vec2 ) +
+           m_frontierSlots.capacity() * sizeof( int ) +
+           m_undoRecords.capacity() * sizeof( UndoRecord ) +
+           m_undoPegs.capacity() * sizeof( Vec2 ) +
+           ( m_runLeft.capacity() + m_runRight.capacity() + m_runUp.capacity() + m_runDown.capacity() ) * sizeof( uint16_t );
+}
+
+bool LegoSet::IsFrontierPeg( const Vec2& pos, const LegoBitmap& legoBitmap ) const
+{
+    // Up, down, left, right offsets
+    static const Vec2 cOffsets[ 4 ] =
+    {
+        Vec2( 0, -1 ),
+        Vec2( 0, 1 ),
+        Vec2(-1, 0 ),
+        Vec2( 1, 0 ),
+    };
+    
+    // Must be an uncovered peg with a color, not already on the frontier
+    if( pos.x < 0 || pos.y < 0 || pos.x >= m_boardSize.x || pos.y >= m_boardSize.y )
+    {
+        return false;
+    }
+    
     int pegIndex = pos.y * m_boardSize.x + pos.x;
-    return m_boardOccupancy[ pegIndex ];
+    if( m_frontierSlots[ pegIndex ] >= 0 || IsPegOccupied( pos ) || legoBitmap.GetBrickColorIndex( pos ) < 0 )
+    {
+        return false;
+    }
+    
+    // Next to the image edge, a placed brick, or an empty pixel
+    for( int i = 0; i < 4; i++ )
+    {
+        Vec2 adjPos( pos.x + cOffsets[ i ].x, pos.y + cOffsets[ i ].y );
+        
+        bool inBoard = adjPos.x >= 0 && adjPos.y >= 0 && adjPos.x < m_boardSize.x && adjPos.y < m_boardSize.y;
+        if( !inBoard || IsPegOccupied( adjPos ) || legoBitmap.GetBrickColorIndex( adjPos ) < 0 )
+        {
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+void LegoSet::AddFrontierPeg( const Vec2& pos )
+{
+    m_frontierSlots[ pos.y * m_boardSize.x + pos.x ] = (int)m_frontier.size();
+    m_frontier.push_back( pos );
+}
+
+void LegoSet::AddFrontierPegLogged( const Vec2& pos, const LegoBitmap& legoBitmap )
+{
+    if( IsFrontierPeg( pos, legoBitmap ) )
+    {
+        AddFrontierPeg( pos );
+        m_undoPegs.push_back( pos );
+    }
+}
+
+void LegoSet::RemoveFrontierPeg( const Vec2& pos )
+{
+    int pegIndex = pos.y * m_boardSize.x + pos.x;
+    int slot = m_frontierSlots[ pegIndex ];
+    if( slot < 0 )
+    {
+        return;
+    }
+    
+    // Swap-remove; the moved peg has to have its slot patched
+    const Vec2 lastPos = m_frontier.back();
+    m_frontier[ slot ] = lastPos;
+    m_frontierSlots[ lastPos.y * m_boardSize.x + lastPos.x ] = slot;
+    m_frontier.pop_back();
+    m_frontierSlots[ pegIndex ] = -1;
+}
+
+void LegoSet::RefreshRuns( const Vec2& pos, const Vec2& size, const LegoBitmap& legoBitmap )
+{
+    // A peg is part of a run if it has a color and is uncovered; runs never cross a color change
+    auto isRunPeg = [&]( int x, int y ) { return !IsPegOccupied( Vec2( x, y ) ) && legoBitmap.GetBrickColorIndex( Vec2( x, y ) ) >= 0; };
+    auto isSameRun = [&]( int x0, int y0, int x1, int y1 ) { return isRunPeg( x1, y1 ) && legoBitmap.GetBrickColorIndex( Vec2( x0, y0 ) ) == legoBitmap.GetBrickColorIndex( Vec2( x1, y1 ) ); };
+    
+    // Rows: widen the span to where the same-color runs around it end, then rebuild left and right runs over it
+    for( int y = pos.y; y < pos.y + size.y; y++ )
+    {
+        int startX = pos.x;
+        int endX = pos.x + size.x - 1;
+        while( startX > 0 && isSameRun( startX, y, startX - 1, y ) ) startX--;
+        while( endX < m_boardSize.x - 1 && isSameRun( endX, y, endX + 1, y ) ) endX++;
+        
+        for( int x = startX; x <= endX; x++ )
+        {
+            int pegIndex = y * m_boardSize.x + x;
+            m_runLeft[ pegIndex ] = !isRunPeg( x, y ) ? 0 : ( ( x > startX && isSameRun( x, y, x - 1, y ) ) ? m_runLeft[ pegIndex - 1 ] + 1 : 1 );
+        }
+        for( int x = endX; x >= startX; x-- )
+        {
+            int pegIndex = y * m_boardSize.x + x;
+            m_runRight[ pegIndex ] = !isRunPeg( x, y ) ? 0 : ( ( x < endX && isSameRun( x, y, x + 1, y ) ) ? m_runRight[ pegIndex + 1 ] + 1 : 1 );
+        }
+    }
+    
+    // Same for columns
+    for( int x = pos.x; x < pos.x + size.x; x++ )
+    {
+        int startY = pos.y;
+        int endY = pos.y + size.y - 1;
+        while( startY > 0 && isSameRun( x, startY, x, startY - 1 ) ) startY--;
+        while( endY < m_boardSize.y - 1 && isSameRun( x, endY, x, endY + 1 ) ) endY++;
+        
+        for( int y = startY; y <= endY; y++ )
+        {
+            int pegIndex = y * m_boardSize.x + x;
+            m_runUp[ pegIndex ] = !isRunPeg( x, y ) ? 0 : ( ( y > startY && isSameRun( x, y, x, y - 1 ) ) ? m_runUp[ pegIndex - m_boardSize.x ] + 1 : 1 );
+        }
+        for( int y = endY; y >= startY; y-- )
+        {
+            int pegIndex = y * m_boardSize.x + x;
+            m_runDown[ pegIndex ] = !isRunPeg( x, y ) ? 0 : ( ( y < endY && isSameRun( x, y, x, y + 1 ) ) ? m_runDown[ pegIndex + m_boardSize.x ] + 1 : 1 );
+        }
+    }
 }
 
 void LegoSet::IterateBrick( const Vec2& pos, const Vec2& size, std::function< void(Vec2) > func )
@@ -18,6 +18,7 @@
 #include <functional>
 
 #include "Vec2.h"
+#include "BitRow.h"
 
 class LegoBitmap;
 
@@ -62,49 +63,180 @@ struct Brick
 };
 typedef std::vector< Brick > BrickList;
 
+// A scored placement while searching; lower rank is better
+// Ties are broken on position (scan order) then definition ID, so the best of a set never depends on search order
+struct BrickCandidate
+{
+    BrickCandidate()
+        : m_rank( 0.0f )
+        , m_definitionId( -1 )
+    {
+    }
+    
+    BrickCandidate( float rank, const Vec2& position, int definitionId )
+        : m_rank( rank )
+        , m_position( position )
+        , m_definitionId( definitionId )
+    {
+    }
+    
+    bool IsValid() const { return m_definitionId >= 0; }
+    
+    // Total order; invalid candidates lose against everything
+    bool IsBetterThan( const BrickCandidate& other ) const
+    {
+        if( !other.IsValid() ) return IsValid();
+        if( !IsValid() ) return false;
+        if( m_rank != other.m_rank ) return m_rank < other.m_rank;
+        if( m_position.y != other.m_position.y ) return m_position.y < other.m_position.y;
+        if( m_position.x != other.m_position.x ) return m_position.x < other.m_position.x;
+        return m_definitionId < other.m_definitionId;
+    }
+    
+    float m_rank;
+    Vec2 m_position;
+    int m_definitionId;
+};
+
 // A set of pieces that can be tested for solution, collision, etc.
 // Note that to save memory usage, we only keep indexes into the brick definition and color list
 class LegoSet
 {
 public:
 
+    // Largest board width or height; the run tables are 16-bit (see m_runLeft), so ConvertMosaic(...) rejects bigger boards
+    static const int cMaxBoardSide = 0xFFFF;
+    
     // Note that the brick definitions is not copied; just used for cost setup
-	LegoSet( const Vec2& boardSize, const BrickList& bricks, const BrickDefinitionList& brickDefinitions );
+    // The bitmap is only read to size the board and to seed the placement frontier
+	LegoSet( const LegoBitmap& legoBitmap, const BrickList& bricks, const BrickDefinitionList& brickDefinitions );
 	LegoSet( const LegoSet& legoSet );
 	~LegoSet();
 	
     // Attempt adding a brick; will return false if unable to add brick (out of bounds, bad color, etc.)
 	bool AddBrick( const Brick& brick, const BrickDefinitionList& brickDefinitions, const LegoBitmap& legoBitmap );
     
+    // Takes back the last brick added with AddBrick(...), restoring the set exactly as it was (frontier order aside)
+    // Bricks given to the constructor can't be taken back; returns false if there is nothing to undo
+    bool RemoveLastBrick( const BrickDefinitionList& brickDefinitions, const LegoBitmap& legoBitmap );
+    
+    // Checkpoints are just brick counts: UndoToCheckpoint(...) removes bricks until the set is back at the checkpoint
+    // Together with AddBrick(...) this is make / unmake for depth-first searches, with no set copies
+    int GetCheckpoint() const { return (int)m_brickList.size(); }
+    void UndoToCheckpoint( int checkpoint, const BrickDefinitionList& brickDefinitions, const LegoBitmap& legoBitmap );
+    
+    // Same checks as AddBrick(...), but nothing is changed (or copied); use this to evaluate candidates
+    bool CanAddBrick( const Brick& brick, const BrickDefinitionList& brickDefinitions, const LegoBitmap& legoBitmap ) const;
+    
+    // Like CanAddBrick(...), but also returns how much GetRank() would change if the brick was added
+    bool ScoreBrick( const Brick& brick, const BrickDefinitionList& brickDefinitions, const LegoBitmap& legoBitmap, float& rankDeltaOut ) const;
+    
 	// Get copy of brick-list
 	const BrickList& GetBrickList() const { return m_brickList; }
 
     // Return true / false on the occupancy state
-    bool IsPegOccupied( const Vec2& pos ) const;
+    bool IsPegOccupied( const Vec2& pos ) const { return BitRowGet( &m_occupancyRows[ pos.y * m_rowWordCount ], pos.x ); }
+    
+    // Uncovered color pegs that are next to a placed brick, an empty pixel or the image edge
+    // Kept up to date by AddBrick(...), so reading it never rescans the board; order is arbitrary
+    const Vec2List& GetFrontier() const { return m_frontier; }
+    bool IsOnFrontier( const Vec2& pos ) const { return m_frontierSlots[ pos.y * m_boardSize.x + pos.x ] >= 0; }
+    
+    // Maximal fit at an uncovered peg: the longest same-color, unoccupied run through it horizontally (x) and vertically (y)
+    // Any brick covering the peg must fit inside these; both are zero on covered or empty pegs
+    Vec2 GetFitExtent( const Vec2& pos ) const
+    {
+        int pegIndex = pos.y * m_boardSize.x + pos.x;
+        if( m_runRight[ pegIndex ] == 0 )
+        {
+            return Vec2( 0, 0 );
+        }
+        return Vec2( m_runLeft[ pegIndex ] + m_runRight[ pegIndex ] - 1, m_runUp[ pegIndex ] + m_runDown[ pegIndex ] - 1 );
+    }
+    
+    // Free space from an uncovered peg towards the right (x) and down (y), counting the peg; both are zero on covered or empty pegs
+    // A brick with its top-left corner on the peg must fit inside these
+    Vec2 GetFreeExtent( const Vec2& pos ) const
+    {
+        int pegIndex = pos.y * m_boardSize.x + pos.x;
+        return Vec2( m_runRight[ pegIndex ], m_runDown[ pegIndex ] );
+    }
+    
+    // First uncovered color peg in scan order, at or after the given peg; false if there is none
+    bool GetFirstUncoveredPeg( const LegoBitmap& legoBitmap, const Vec2& startPos, Vec2& pegOut ) const;
+    
+    // Returns true if all color pegs are covered by bricks
+    bool IsSolved() const { return m_uncoveredPegCount <= 0; }
+    int GetUncoveredPegCount() const { return m_uncoveredPegCount; }
+    
+    // Zobrist hashes (see Zobrist.h), kept up to date as bricks are added
+    // Coverage only hashes which pegs are covered, not how; sets with the same coverage need the same bricks to finish
+    uint64_t GetPlacementHash() const { return m_placementHash; }
+    uint64_t GetCoverageHash() const { return m_coverageHash; }
+    
+    // Rough heap footprint of one set, for search memory budgets
+    size_t GetMemoryUsage() const;
     
 	// Cost of the brick list in pennies
 	int GetCost() const { return m_cost; }
     float GetPlacedPegCount() const { return m_pegCount; }
     
     // Note that rank is the heuristic used when searching; lower peg count is more important than price
-    float GetRank() const { return - ( float( m_pegCount ) / float( m_brickList.size() ) ) * 100.0f - float( m_cost ); }
+    // An empty set has a rank of zero, so that rank deltas from it are still well defined
+    float GetRank() const { return m_brickList.empty() ? 0.0f : - ( float( m_pegCount ) / float( m_brickList.size() ) ) * 100.0f - float( m_cost ); }
     
 protected:
     
 	// Executes over the 2D given array size, or iterate over the brick's pegs
 	void IterateBrick( const Vec2& pos, const Vec2& size, std::function< void(Vec2) > func );
     
+    // Frontier helpers; a peg is only ever added once and is removed when covered
+    bool IsFrontierPeg( const Vec2& pos, const LegoBitmap& legoBitmap ) const;
+    void AddFrontierPeg( const Vec2& pos );
+    
+    // Adds the peg if it now belongs on the frontier, logging it for RemoveLastBrick(...)
+    void AddFrontierPegLogged( const Vec2& pos, const LegoBitmap& legoBitmap );
+    void RemoveFrontierPeg( const Vec2& pos );
+    
+    // Recomputes the run tables on every row and column crossing the given rectangle, out to where runs end
+    void RefreshRuns( const Vec2& pos, const Vec2& size, const LegoBitmap& legoBitmap );
+    
 private:
 	
 	Vec2 m_boardSize;
 	BrickList m_brickList;
     
-	// 2D map of all bricks; int maps to m_brickList objects, indexed by 2D map value
-	std::vector< bool > m_boardOccupancy;
+	// Occupancy bit rows (see BitRow.h): m_occupancyRows[ y * m_rowWordCount + word ]
+	std::vector< uint64_t > m_occupancyRows;
+    int m_rowWordCount;
+    
+    // Placement frontier; m_frontierSlots maps a peg index to its slot in m_frontier, or -1 when not on it
+    Vec2List m_frontier;
+    std::vector< int > m_frontierSlots;
+    
+    // Undo log: per brick added by AddBrick(...), where its frontier changes start in m_undoPegs
+    // The first m_removedCount pegs were taken off the frontier (under the brick); the rest were added around it
+    struct UndoRecord
+    {
+        int m_pegStart;
+        int m_removedCount;
+    };
+    std::vector< UndoRecord > m_undoRecords;
+    Vec2List m_undoPegs;
+    
+    // Per-peg run lengths of same-color, unoccupied pegs in each direction, counting the peg itself (0 when covered)
+    // Note that these are 16-bit to keep copies small, so boards can't be more than cMaxBoardSide pegs wide or tall
+    std::vector< uint16_t > m_runLeft;
+    std::vector< uint16_t > m_runRight;
+    std::vector< uint16_t > m_runUp;
+    std::vector< uint16_t > m_runDown;
     
 	// Cached states
 	int m_cost;
     int m_pegCount;
+    int m_uncoveredPegCount;
+    uint64_t m_placementHash;
+    uint64_t m_coverageHash;
 };
 
 #endif // __LEGOSET_H__
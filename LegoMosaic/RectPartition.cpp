@@ -0,0 +1,324 @@
+/***
+
+ LegoBitmap - Converts BMP into a Lego Mosaic
+ Copyright (c) 2014 Jeremy Bridon
+
+***/
+
+#include "RectPartition.h"
+
+#include <algorithm>
+#include <assert.h>
+
+namespace
+{
+    // Axis-parallel segment between two concave corners, from its left (or top) end
+    struct Chord
+    {
+        Vec2 m_start;
+        Vec2 m_end;
+    };
+    
+    // One level of an augmenting path search: a horizontal chord, the next of its crossings to try, and the vertical
+    // chord (matched to it) the search came in through
+    struct AugmentStep
+    {
+        int m_chordH;
+        int m_nextCrossing;
+        int m_viaV;
+    };
+}
+
+int PartitionIntoRectangles( const std::vector< char >& cells, const Vec2& size, std::vector< PartitionRect >& rectanglesOut )
+{
+    const int width = size.x;
+    const int height = size.y;
+
+    // Points are cell corners, ( 0, 0 ) to ( width, height ); a point's cells are the four around it
+    auto isInside = [&]( int x, int y ) { return x >= 0 && y >= 0 && x < width && y < height && cells[ y * width + x ] != 0; };
+    auto getInsideCount = [&]( int x, int y ) { return int( isInside( x - 1, y - 1 ) ) + int( isInside( x, y - 1 ) ) + int( isInside( x - 1, y ) ) + int( isInside( x, y ) ); };
+    auto isConcave = [&]( int x, int y ) { return getInsideCount( x, y ) == 3; };
+
+    // Unit edges: horizontal edge ( x, y ) runs from point ( x, y ) to ( x + 1, y ), vertical edge ( x, y ) from ( x, y ) to ( x, y + 1 )
+    // An edge is interior if there are inside cells on both sides of it; cuts are only ever made on interior edges
+    auto isInteriorH = [&]( int x, int y ) { return isInside( x, y - 1 ) && isInside( x, y ); };
+    auto isInteriorV = [&]( int x, int y ) { return isInside( x - 1, y ) && isInside( x, y ); };
+    std::vector< char > cutH( ( height + 1 ) * width, 0 );
+    std::vector< char > cutV( height * ( width + 1 ), 0 );
+
+    // 1. Chords; a concave corner has one interior edge per axis, and a chord runs along it to the next concave corner
+    // (any other point where the interior ends is a plain boundary, and gives no chord)
+    std::vector< Chord > chordsH;
+    std::vector< Chord > chordsV;
+    for( int y = 0; y <= height; y++ )
+    {
+        for( int x = 0; x <= width; x++ )
+        {
+            if( !isConcave( x, y ) )
+            {
+                continue;
+            }
+
+            if( x < width && isInteriorH( x, y ) )
+            {
+                int endX = x + 1;
+                while( !isConcave( endX, y ) && endX < width && isInteriorH( endX, y ) )
+                {
+                    endX++;
+                }
+                if( isConcave( endX, y ) )
+                {
+                    Chord chord = { Vec2( x, y ), Vec2( endX, y ) };
+                    chordsH.push_back( chord );
+                }
+            }
+
+            if( y < height && isInteriorV( x, y ) )
+            {
+                int endY = y + 1;
+                while( !isConcave( x, endY ) && endY < height && isInteriorV( x, endY ) )
+                {
+                    endY++;
+                }
+                if( isConcave( x, endY ) )
+                {
+                    Chord chord = { Vec2( x, y ), Vec2( x, endY ) };
+                    chordsV.push_back( chord );
+                }
+            }
+        }
+    }
+
+    // 2. Maximum matching between crossing horizontal and vertical chords (Kuhn's augmenting paths)
+    // Chords that only share an end cross too: cutting both would spend two chords on one corner
+    const int countH = (int)chordsH.size();
+    const int countV = (int)chordsV.size();
+    std::vector< std::vector< int > > crossings( countH );
+    for( int i = 0; i < countH; i++ )
+    {
+        for( int j = 0; j < countV; j++ )
+        {
+            if( chordsV[ j ].m_start.x >= chordsH[ i ].m_start.x && chordsV[ j ].m_start.x <= chordsH[ i ].m_end.x &&
+                chordsH[ i ].m_start.y >= chordsV[ j ].m_start.y && chordsH[ i ].m_start.y <= chordsV[ j ].m_end.y )
+            {
+                crossings[ i ].push_back( j );
+            }
+        }
+    }
+
+    std::vector< int > matchH( countH, -1 );
+    std::vector< int > matchV( countV, -1 );
+    std::vector< int > visitStamps( countV, -1 );
+    std::vector< AugmentStep > path;
+    for( int root = 0; root < countH; root++ )
+    {
+        // Depth-first on an explicit stack, so a huge region can't run out of call stack
+        AugmentStep rootStep = { root, 0, -1 };
+        path.assign( 1, rootStep );
+        while( !path.empty() )
+        {
+            AugmentStep& step = path.back();
+            if( step.m_nextCrossing == (int)crossings[ step.m_chordH ].size() )
+            {
+                path.pop_back();
+                continue;
+            }
+
+            int j = crossings[ step.m_chordH ][ step.m_nextCrossing++ ];
+            if( visitStamps[ j ] == root )
+            {
+                continue;
+            }
+            visitStamps[ j ] = root;
+
+            if( matchV[ j ] >= 0 )
+            {
+                AugmentStep nextStep = { matchV[ j ], 0, j };
+                path.push_back( nextStep );
+                continue;
+            }
+
+            // Free vertical chord: flip every match along the path, from the top down
+            for( int level = (int)path.size() - 1; level >= 0; level-- )
+            {
+                int i = path[ level ].m_chordH;
+                matchV[ j ] = i;
+                matchH[ i ] = j;
+                j = path[ level ].m_viaV;
+            }
+            break;
+        }
+    }
+
+    // 3. Konig: from the unmatched horizontal chords, follow crossings out and matches back; the horizontal chords reached
+    // and the vertical ones not reached are a largest set of chords that don't cross, and each one is cut
+    std::vector< char > reachedH( countH, 0 );
+    std::vector< char > reachedV( countV, 0 );
+    std::vector< int > openH;
+    for( int i = 0; i < countH; i++ )
+    {
+        if( matchH[ i ] < 0 )
+        {
+            reachedH[ i ] = 1;
+            openH.push_back( i );
+        }
+    }
+    for( int n = 0; n < (int)openH.size(); n++ )
+    {
+        const std::vector< int >& crossed = crossings[ openH[ n ] ];
+        for( int k = 0; k < (int)crossed.size(); k++ )
+        {
+            int j = crossed[ k ];
+            if( reachedV[ j ] )
+            {
+                continue;
+            }
+            reachedV[ j ] = 1;
+
+            int i = matchV[ j ];
+            if( i >= 0 && !reachedH[ i ] )
+            {
+                reachedH[ i ] = 1;
+                openH.push_back( i );
+            }
+        }
+    }
+
+    for( int i = 0; i < countH; i++ )
+    {
+        for( int x = chordsH[ i ].m_start.x; reachedH[ i ] && x < chordsH[ i ].m_end.x; x++ )
+        {
+            cutH[ chordsH[ i ].m_start.y * width + x ] = 1;
+        }
+    }
+    for( int j = 0; j < countV; j++ )
+    {
+        for( int y = chordsV[ j ].m_start.y; !reachedV[ j ] && y < chordsV[ j ].m_end.y; y++ )
+        {
+            cutV[ y * ( width + 1 ) + chordsV[ j ].m_start.x ] = 1;
+        }
+    }
+
+    // 4. Every concave corner not yet on a cut gets a horizontal one, along its interior edge, up to the boundary or a cut
+    auto isOnCut = [&]( int x, int y )
+    {
+        return ( x > 0 && cutH[ y * width + x - 1 ] ) || ( x < width && cutH[ y * width + x ] ) ||
+               ( y > 0 && cutV[ ( y - 1 ) * ( width + 1 ) + x ] ) || ( y < height && cutV[ y * ( width + 1 ) + x ] );
+    };
+    for( int y = 0; y <= height; y++ )
+    {
+        for( int x = 0; x <= width; x++ )
+        {
+            if( !isConcave( x, y ) || isOnCut( x, y ) )
+            {
+                continue;
+            }
+
+            int step = ( x < width && isInteriorH( x, y ) ) ? 1 : -1;
+            for( int pointX = x; ; )
+            {
+                int edgeX = ( step > 0 ) ? pointX : pointX - 1;
+                if( edgeX < 0 || edgeX >= width || !isInteriorH( edgeX, y ) )
+                {
+                    break;
+                }
+
+                // Check the next point before cutting up to it: it ends the cut if it is already on one
+                pointX += step;
+                bool stop = isOnCut( pointX, y ) || getInsideCount( pointX, y ) < 4;
+                cutH[ y * width + edgeX ] = 1;
+                if( stop )
+                {
+                    break;
+                }
+            }
+        }
+    }
+
+    // 5. Pieces: cells joined across edges that weren't cut; each one is now a rectangle
+    std::vector< int > pieceIds( width * height, -1 );
+    std::vector< int > stack;
+    int rectangleCount = 0;
+    for( int startY = 0; startY < height; startY++ )
+    {
+        for( int startX = 0; startX < width; startX++ )
+        {
+            if( !isInside( startX, startY ) || pieceIds[ startY * width + startX ] >= 0 )
+            {
+                continue;
+            }
+
+            const int pieceId = startY * width + startX;
+            Vec2 pieceMin( startX, startY );
+            Vec2 pieceMax( startX, startY );
+            int cellCount = 0;
+
+            pieceIds[ pieceId ] = pieceId;
+            stack.push_back( pieceId );
+            while( !stack.empty() )
+            {
+                int cell = stack.back();
+                stack.pop_back();
+
+                int x = cell % width;
+                int y = cell / width;
+                pieceMin = Vec2( std::min( pieceMin.x, x ), std::min( pieceMin.y, y ) );
+                pieceMax = Vec2( std::max( pieceMax.x, x ), std::max( pieceMax.y, y ) );
+                cellCount++;
+
+                // Right, left, down, up; each across the unit edge between the two cells
+                const int neighbors[ 4 ][ 3 ] = {
+                    { x + 1, y, ( x + 1 < width ) ? !cutV[ y * ( width + 1 ) + x + 1 ] : 0 },
+                    { x - 1, y, ( x > 0 ) ? !cutV[ y * ( width + 1 ) + x ] : 0 },
+                    { x, y + 1, ( y + 1 < height ) ? !cutH[ ( y + 1 ) * width + x ] : 0 },
+                    { x, y - 1, ( y > 0 ) ? !cutH[ y * width + x ] : 0 },
+                };
+                for( int i = 0; i < 4; i++ )
+                {
+                    int neighbor = neighbors[ i ][ 1 ] * width + neighbors[ i ][ 0 ];
+                    if( neighbors[ i ][ 2 ] && isInside( neighbors[ i ][ 0 ], neighbors[ i ][ 1 ] ) && pieceIds[ neighbor ] < 0 )
+                    {
+                        pieceIds[ neighbor ] = pieceId;
+                        stack.push_back( neighbor );
+                    }
+                }
+            }
+
+            Vec2 pieceSize( pieceMax.x - pieceMin.x + 1, pieceMax.y - pieceMin.y + 1 );
+            if( cellCount == pieceSize.x * pieceSize.y )
+            {
+                PartitionRect rectangle = { pieceMin, pieceSize };
+                rectanglesOut.push_back( rectangle );
+                rectangleCount++;
+                continue;
+            }
+
+            // Not a rectangle; this is a bug in the cuts above, so debug builds stop here, and release builds fall back
+            // to the piece's row runs so the cover is still exact
+            assert( !"PartitionIntoRectangles: piece is not a rectangle" );
+            for( int y = pieceMin.y; y <= pieceMax.y; y++ )
+            {
+                for( int x = pieceMin.x; x <= pieceMax.x; x++ )
+                {
+                    if( pieceIds[ y * width + x ] != pieceId )
+                    {
+                        continue;
+                    }
+
+                    int runEnd = x;
+                    while( runEnd + 1 <= pieceMax.x && pieceIds[ y * width + runEnd + 1 ] == pieceId )
+                    {
+                        runEnd++;
+                    }
+
+                    PartitionRect rectangle = { Vec2( x, y ), Vec2( runEnd - x + 1, 1 ) };
+                    rectanglesOut.push_back( rectangle );
+                    rectangleCount++;
+                    x = runEnd;
+                }
+            }
+        }
+    }
+
+    return rectangleCount;
+}
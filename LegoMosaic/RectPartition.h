@@ -0,0 +1,35 @@
+/***
+
+ LegoBitmap - Converts BMP into a Lego Mosaic
+ Copyright (c) 2014 Jeremy Bridon
+
+ Description: Splits a set of grid cells (a rectilinear
+ polygon, possibly with holes and several pieces) into the
+ fewest rectangles. Chords join pairs of concave corners on
+ one grid line; a largest set of chords that don't cross is
+ found through a maximum bipartite matching between the
+ horizontal and vertical chords (Konig's theorem), those are
+ cut, and every concave corner left over gets one straight
+ cut to the nearest boundary or cut.
+
+***/
+
+#ifndef __RECTPARTITION_H__
+#define __RECTPARTITION_H__
+#pragma once
+
+#include <vector>
+
+#include "Vec2.h"
+
+struct PartitionRect
+{
+    Vec2 m_origin;
+    Vec2 m_size;
+};
+
+// Cells are size.x * size.y, row-major, nonzero where inside; the rectangles are appended in scan order of their corners
+// Returns the number of rectangles appended
+int PartitionIntoRectangles( const std::vector< char >& cells, const Vec2& size, std::vector< PartitionRect >& rectanglesOut );
+
+#endif // __RECTPARTITION_H__
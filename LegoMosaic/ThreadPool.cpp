@@ -0,0 +1,162 @@
+/***
+
+ LegoBitmap - Converts BMP into a Lego Mosaic
+ Copyright (c) 2014 Jeremy Bridon
+
+***/
+
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool( int workerCount )
+    : m_workerCount( workerCount < 1 ? 1 : workerCount )
+    , m_job( NULL )
+    , m_pendingTasks( 0 )
+    , m_generation( 0 )
+    , m_shutdown( false )
+{
+    for( int i = 0; i < m_workerCount; i++ )
+    {
+        m_queues.push_back( new WorkerQueue() );
+    }
+
+    // Worker 0 is whoever calls ParallelFor(...), so only start the rest
+    for( int i = 1; i < m_workerCount; i++ )
+    {
+        m_threads.push_back( std::thread( &ThreadPool::WorkerLoop, this, i ) );
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard< std::mutex > guard( m_lock );
+        m_shutdown = true;
+    }
+    m_wakeCondition.notify_all();
+
+    for( int i = 0; i < (int)m_threads.size(); i++ )
+    {
+        m_threads[ i ].join();
+    }
+
+    for( int i = 0; i < (int)m_queues.size(); i++ )
+    {
+        delete m_queues[ i ];
+    }
+}
+
+void ThreadPool::ParallelFor( int taskCount, const std::function< void(int, int) >& func, int minParallelCount )
+{
+    if( taskCount <= 0 )
+    {
+        return;
+    }
+
+    // Not worth dispatching; just run it here
+    if( m_workerCount <= 1 || taskCount < minParallelCount )
+    {
+        for( int i = 0; i < taskCount; i++ )
+        {
+            func( i, 0 );
+        }
+        return;
+    }
+
+    // Job must be visible before any task is, since late workers may pop a task the moment it's queued
+    m_job = &func;
+    m_pendingTasks = taskCount;
+
+    // Deal out contiguous blocks, so neighboring tasks (which tend to cost about the same) stay on one worker
+    for( int i = 0; i < m_workerCount; i++ )
+    {
+        WorkerQueue* queue = m_queues[ i ];
+        int start = int( int64_t( taskCount ) * i / m_workerCount );
+        int end = int( int64_t( taskCount ) * ( i + 1 ) / m_workerCount );
+
+        std::lock_guard< std::mutex > guard( queue->m_lock );
+        for( int taskIndex = start; taskIndex < end; taskIndex++ )
+        {
+            queue->m_tasks.push_back( taskIndex );
+        }
+    }
+
+    {
+        std::lock_guard< std::mutex > guard( m_lock );
+        m_generation++;
+    }
+    m_wakeCondition.notify_all();
+
+    // Help out, then wait for the stragglers
+    RunTasks( 0 );
+
+    std::unique_lock< std::mutex > lock( m_lock );
+    m_doneCondition.wait( lock, [&]() { return m_pendingTasks.load() <= 0; } );
+    m_job = NULL;
+}
+
+void ThreadPool::WorkerLoop( int workerIndex )
+{
+    uint64_t seenGeneration = 0;
+
+    while( true )
+    {
+        {
+            std::unique_lock< std::mutex > lock( m_lock );
+            m_wakeCondition.wait( lock, [&]() { return m_shutdown || m_generation != seenGeneration; } );
+
+            if( m_shutdown )
+            {
+                return;
+            }
+            seenGeneration = m_generation;
+        }
+
+        RunTasks( workerIndex );
+    }
+}
+
+void ThreadPool::RunTasks( int workerIndex )
+{
+    int taskIndex = 0;
+    while( PopTask( workerIndex, taskIndex ) )
+    {
+        (*m_job)( taskIndex, workerIndex );
+
+        // Last one out wakes up the caller
+        if( --m_pendingTasks == 0 )
+        {
+            std::lock_guard< std::mutex > guard( m_lock );
+            m_doneCondition.notify_all();
+        }
+    }
+}
+
+bool ThreadPool::PopTask( int workerIndex, int& taskIndexOut )
+{
+    // Own work first, oldest first
+    {
+        WorkerQueue* queue = m_queues[ workerIndex ];
+        std::lock_guard< std::mutex > guard( queue->m_lock );
+        if( !queue->m_tasks.empty() )
+        {
+            taskIndexOut = queue->m_tasks.front();
+            queue->m_tasks.pop_front();
+            return true;
+        }
+    }
+
+    // Steal from the far end of everyone else, starting with our neighbor
+    for( int i = 1; i < m_workerCount; i++ )
+    {
+        WorkerQueue* queue = m_queues[ ( workerIndex + i ) % m_workerCount ];
+        std::lock_guard< std::mutex > guard( queue->m_lock );
+        if( !queue->m_tasks.empty() )
+        {
+            taskIndexOut = queue->m_tasks.back();
+            queue->m_tasks.pop_back();
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,77 @@
+/***
+
+ LegoBitmap - Converts BMP into a Lego Mosaic
+ Copyright (c) 2014 Jeremy Bridon
+
+ Description: Persistent pool of worker threads used to
+ evaluate brick candidates. Each worker owns a deque of
+ task indices and steals from the back of the others'
+ deques once its own runs dry, so uneven tasks still keep
+ every core busy. The calling thread works as worker 0.
+
+***/
+
+#ifndef __THREADPOOL_H__
+#define __THREADPOOL_H__
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+#include <stdint.h>
+
+class ThreadPool
+{
+public:
+
+    // A worker count of one (or less) never starts a thread; everything runs inline
+    ThreadPool( int workerCount );
+    ~ThreadPool();
+
+    int GetWorkerCount() const { return m_workerCount; }
+
+    // Calls func( taskIndex, workerIndex ) for each task index in [0, taskCount), returns once all are done
+    // Fewer than minParallelCount tasks are run inline, since waking the workers would cost more than it saves
+    void ParallelFor( int taskCount, const std::function< void(int, int) >& func, int minParallelCount = 2 );
+
+protected:
+
+    // Worker thread body: sleep until a new job is posted, then run tasks until none are left
+    void WorkerLoop( int workerIndex );
+
+    // Runs tasks from the worker's own deque, then steals; returns when every deque is empty
+    void RunTasks( int workerIndex );
+
+    // Pops from the front of our own deque, or the back of another worker's deque; false if all are empty
+    bool PopTask( int workerIndex, int& taskIndexOut );
+
+private:
+
+    struct WorkerQueue
+    {
+        std::mutex m_lock;
+        std::deque< int > m_tasks;
+    };
+
+    int m_workerCount;
+    std::vector< std::thread > m_threads;
+    std::vector< WorkerQueue* > m_queues;
+
+    // Current job; only changed by ParallelFor(...) while no tasks are pending
+    const std::function< void(int, int) >* m_job;
+    std::atomic< int > m_pendingTasks;
+
+    // Job posting and completion signaling
+    std::mutex m_lock;
+    std::condition_variable m_wakeCondition;
+    std::condition_variable m_doneCondition;
+    uint64_t m_generation;
+    bool m_shutdown;
+};
+
+#endif // __THREADPOOL_H__
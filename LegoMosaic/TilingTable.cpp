@@ -0,0 +1,328 @@
+/***
+
+ LegoBitmap - Converts BMP into a Lego Mosaic
+ Copyright (c) 2014 Jeremy Bridon
+
+***/
+
+#include "TilingTable.h"
+#include "Zobrist.h"
+
+#include <algorithm>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+
+namespace
+{
+    // Cuts are tried at every offset up to this far from an edge, so rectangles up to twice this on a side are tiled
+    // optimally; larger ones only peel strips of up to this size off their edges, which keeps an entry's work bounded
+    const int cMaxCutOffset = 64;
+
+    const char* cFileTag = "LegoMosaicTilingTable";
+}
+
+TilingTable::TilingTable( const BrickDefinitionList& brickDefinitions )
+    : m_brickDefinitions( brickDefinitions )
+    , m_catalogHash( ZobristMix( brickDefinitions.size() ) )
+{
+    for( int i = 0; i < (int)m_brickDefinitions.size(); i++ )
+    {
+        const BrickDefinition& brickDef = m_brickDefinitions[ i ];
+        uint64_t packed = ( uint64_t( uint16_t( brickDef.m_shape.x ) ) << 48 ) | ( uint64_t( uint16_t( brickDef.m_shape.y ) ) << 32 ) | uint32_t( brickDef.m_cost );
+        m_catalogHash = ZobristMix( m_catalogHash ^ packed );
+    }
+}
+
+bool TilingTable::Tile( const Vec2& origin, const Vec2& size, int colorIndex, BrickList& bricksOut )
+{
+    if( size.x <= 0 || size.y <= 0 )
+    {
+        return true;
+    }
+
+    // Walk the cuts down to the bricks; bricks are only handed out once the whole walk succeeded
+    BrickList bricks;
+    std::vector< std::pair< Vec2, Vec2 > > pending( 1, std::make_pair( origin, size ) );
+    while( !pending.empty() )
+    {
+        Vec2 pieceOrigin = pending.back().first;
+        Vec2 pieceSize = pending.back().second;
+        pending.pop_back();
+
+        Entry entry = Compute( pieceSize.x, pieceSize.y );
+        if( entry.m_kind == TilingKind_Brick )
+        {
+            bricks.push_back( Brick( entry.m_choice, colorIndex, pieceOrigin ) );
+        }
+        else if( entry.m_kind == TilingKind_CutX && entry.m_choice >= 1 && entry.m_choice < pieceSize.x )
+        {
+            pending.push_back( std::make_pair( Vec2( pieceOrigin.x + entry.m_choice, pieceOrigin.y ), Vec2( pieceSize.x - entry.m_choice, pieceSize.y ) ) );
+            pending.push_back( std::make_pair( pieceOrigin, Vec2( entry.m_choice, pieceSize.y ) ) );
+        }
+        else if( entry.m_kind == TilingKind_CutY && entry.m_choice >= 1 && entry.m_choice < pieceSize.y )
+        {
+            pending.push_back( std::make_pair( Vec2( pieceOrigin.x, pieceOrigin.y + entry.m_choice ), Vec2( pieceSize.x, pieceSize.y - entry.m_choice ) ) );
+            pending.push_back( std::make_pair( pieceOrigin, Vec2( pieceSize.x, entry.m_choice ) ) );
+        }
+        else
+        {
+            // Untileable piece (TilingKind_None)
+            return false;
+        }
+    }
+
+    bricksOut.insert( bricksOut.end(), bricks.begin(), bricks.end() );
+    return true;
+}
+
+TilingTable::Entry TilingTable::Compute( int width, int height )
+{
+    Entry entry = { -1, 0, TilingKind_None };
+    if( FindEntry( GetKey( width, height ), entry ) )
+    {
+        return entry;
+    }
+
+    // Sizes waiting on their pieces. A size whose pieces aren't all known pushes the missing ones and is evaluated
+    // again once they're done, so each size is evaluated at most twice. The same size may be pushed more than once
+    std::vector< Vec2 > pending( 1, Vec2( width, height ) );
+    while( !pending.empty() )
+    {
+        const Vec2 size = pending.back();
+        const uint64_t key = GetKey( size.x, size.y );
+
+        Entry known;
+        if( FindEntry( key, known ) )
+        {
+            pending.pop_back();
+            continue;
+        }
+
+        // Cheapest single brick of exactly this shape, then every cut; ties keep the earlier choice, so the table is deterministic
+        Entry best = { -1, 0, TilingKind_None };
+        for( int i = 0; i < (int)m_brickDefinitions.size(); i++ )
+        {
+            const BrickDefinition& brickDef = m_brickDefinitions[ i ];
+            if( brickDef.m_shape.x == size.x && brickDef.m_shape.y == size.y && ( best.m_cost < 0 || brickDef.m_cost < best.m_cost ) )
+            {
+                best.m_cost = brickDef.m_cost;
+                best.m_choice = i;
+                best.m_kind = TilingKind_Brick;
+            }
+        }
+
+        // A cut and its mirror give the same two pieces, so only the first half of the offsets is tried
+        bool ready = true;
+        for( int axis = 0; axis < 2; axis++ )
+        {
+            const bool cutX = ( axis == 0 );
+            const int length = cutX ? size.x : size.y;
+            for( int offset = 1; offset <= std::min( length / 2, cMaxCutOffset ); offset++ )
+            {
+                const Vec2 size0 = cutX ? Vec2( offset, size.y ) : Vec2( size.x, offset );
+                const Vec2 size1 = cutX ? Vec2( size.x - offset, size.y ) : Vec2( size.x, size.y - offset );
+
+                Entry piece0, piece1;
+                bool found0 = FindEntry( GetKey( size0.x, size0.y ), piece0 );
+                bool found1 = FindEntry( GetKey( size1.x, size1.y ), piece1 );
+                if( !found0 )
+                {
+                    pending.push_back( size0 );
+                }
+                if( !found1 )
+                {
+                    pending.push_back( size1 );
+                }
+                if( !found0 || !found1 )
+                {
+                    ready = false;
+                    continue;
+                }
+
+                if( piece0.m_cost >= 0 && piece1.m_cost >= 0 && ( best.m_cost < 0 || piece0.m_cost + piece1.m_cost < best.m_cost ) )
+                {
+                    best.m_cost = piece0.m_cost + piece1.m_cost;
+                    best.m_choice = offset;
+                    best.m_kind = cutX ? TilingKind_CutX : TilingKind_CutY;
+                }
+            }
+        }
+
+        // Not ready: the missing pieces are on top of this size and get done first
+        if( ready )
+        {
+            StoreEntry( key, best );
+            pending.pop_back();
+        }
+    }
+
+    FindEntry( GetKey( width, height ), entry );
+    return entry;
+}
+
+bool TilingTable::FindEntry( uint64_t key, Entry& entryOut )
+{
+    std::lock_guard< std::mutex > lock( m_mutex );
+    std::unordered_map< uint64_t, Entry >::const_iterator found = m_entries.find( key );
+    if( found == m_entries.end() )
+    {
+        return false;
+    }
+    entryOut = found->second;
+    return true;
+}
+
+void TilingTable::StoreEntry( uint64_t key, const Entry& entry )
+{
+    std::lock_guard< std::mutex > lock( m_mutex );
+    m_entries[ key ] = entry;
+}
+
+bool TilingTable::Load( const char* fileName )
+{
+    FILE* file = fopen( fileName, "r" );
+    if( file == NULL )
+    {
+        return false;
+    }
+
+    char tag[ 64 ] = "";
+    unsigned long long catalogHash = 0;
+    int entryCount = 0;
+    if( fscanf( file, "%63s %llx %d", tag, &catalogHash, &entryCount ) != 3 || strcmp( tag, cFileTag ) != 0 || catalogHash != m_catalogHash )
+    {
+        fclose( file );
+        return false;
+    }
+
+    // Read everything before touching the table, so a truncated file is ignored as a whole
+    std::unordered_map< uint64_t, Entry > entries;
+    for( int i = 0; i < entryCount; i++ )
+    {
+        int width = 0, height = 0;
+        Entry entry = { -1, 0, TilingKind_None };
+        if( fscanf( file, "%d %d %d %d %d", &width, &height, &entry.m_cost, &entry.m_choice, &entry.m_kind ) != 5 || width <= 0 || height <= 0 )
+        {
+            fclose( file );
+            return false;
+        }
+        entries[ GetKey( width, height ) ] = entry;
+    }
+    fclose( file );
+
+    // Every entry must describe a real tiling of its size: a brick of exactly that shape and cost, or a cut strictly inside
+    // it whose two pieces are in the file and add up to its cost. Pieces are always smaller, so Tile(...) always ends
+    for( std::unordered_map< uint64_t, Entry >::const_iterator it = entries.begin(); it != entries.end(); ++it )
+    {
+        const int width = int( it->first >> 32 );
+        const int height = int( it->first & 0xFFFFFFFF );
+        const Entry& entry = it->second;
+
+        bool valid = false;
+        if( entry.m_kind == TilingKind_None )
+        {
+            valid = ( entry.m_cost == -1 );
+        }
+        else if( entry.m_kind == TilingKind_Brick )
+        {
+            valid = entry.m_choice >= 0 && entry.m_choice < (int)m_brickDefinitions.size() &&
+                    m_brickDefinitions[ entry.m_choice ].m_shape.x == width && m_brickDefinitions[ entry.m_choice ].m_shape.y == height &&
+                    m_brickDefinitions[ entry.m_choice ].m_cost == entry.m_cost;
+        }
+        else if( entry.m_kind == TilingKind_CutX || entry.m_kind == TilingKind_CutY )
+        {
+            const bool cutX = ( entry.m_kind == TilingKind_CutX );
+            const int length = cutX ? width : height;
+            if( entry.m_choice >= 1 && entry.m_choice < length )
+            {
+                std::unordered_map< uint64_t, Entry >::const_iterator piece0 = entries.find( cutX ? GetKey( entry.m_choice, height ) : GetKey( width, entry.m_choice ) );
+                std::unordered_map< uint64_t, Entry >::const_iterator piece1 = entries.find( cutX ? GetKey( width - entry.m_choice, height ) : GetKey( width, height - entry.m_choice ) );
+                valid = piece0 != entries.end() && piece1 != entries.end() && piece0->second.m_kind != TilingKind_None && piece1->second.m_kind != TilingKind_None &&
+                        piece0->second.m_cost + piece1->second.m_cost == entry.m_cost;
+            }
+        }
+
+        if( !valid )
+        {
+            return false;
+        }
+    }
+
+    // Sizes the file says can't be tiled aren't taken on trust; Compute(...) works them out again if they're asked for
+    std::lock_guard< std::mutex > lock( m_mutex );
+    for( std::unordered_map< uint64_t, Entry >::const_iterator it = entries.begin(); it != entries.end(); ++it )
+    {
+        if( it->second.m_kind != TilingKind_None )
+        {
+            m_entries[ it->first ] = it->second;
+        }
+    }
+    return true;
+}
+
+bool TilingTable::Save( const char* fileName )
+{
+    // Sorted by size, so the same table always writes the same file
+    std::vector< std::pair< uint64_t, Entry > > entries;
+    {
+        std::lock_guard< std::mutex > lock( m_mutex );
+        entries.assign( m_entries.begin(), m_entries.end() );
+    }
+    std::sort( entries.begin(), entries.end(), []( const std::pair< uint64_t, Entry >& a, const std::pair< uint64_t, Entry >& b ) { return a.first < b.first; } );
+
+    // Written next to the target and renamed over it, so a run that dies mid-write never leaves a truncated table
+    std::string tempFileName = std::string( fileName ) + ".tmp";
+    FILE* file = fopen( tempFileName.c_str(), "w" );
+    if( file == NULL )
+    {
+        return false;
+    }
+
+    fprintf( file, "%s %016llx %d\n", cFileTag, (unsigned long long)m_catalogHash, (int)entries.size() );
+    for( int i = 0; i < (int)entries.size(); i++ )
+    {
+        const Entry& entry = entries[ i ].second;
+        fprintf( file, "%d %d %d %d %d\n", int( entries[ i ].first >> 32 ), int( entries[ i ].first & 0xFFFFFFFF ), entry.m_cost, entry.m_choice, entry.m_kind );
+    }
+
+    bool written = ferror( file ) == 0;
+    written = fclose( file ) == 0 && written;
+    if( !written )
+    {
+        remove( tempFileName.c_str() );
+        return false;
+    }
+
+    // rename replaces the target in one step on POSIX; Windows refuses to rename over an existing file, so retry
+    // once with the old table removed
+    if( rename( tempFileName.c_str(), fileName ) != 0 )
+    {
+        remove( fileName );
+        if( rename( tempFileName.c_str(), fileName ) != 0 )
+        {
+            remove( tempFileName.c_str() );
+            return false;
+        }
+    }
+    return true;
+}
+
+std::string TilingTable::GetFileName( const char* directory ) const
+{
+    char fileName[ 64 ];
+    sprintf( fileName, "TilingTable_%016llx.txt", (unsigned long long)m_catalogHash );
+
+    std::string path = directory;
+    if( !path.empty() && path[ path.size() - 1 ] != '/' && path[ path.size() - 1 ] != '\\' )
+    {
+        path += "/";
+    }
+    return path + fileName;
+}
+
+int TilingTable::GetEntryCount()
+{
+    std::lock_guard< std::mutex > lock( m_mutex );
+    return (int)m_entries.size();
+}
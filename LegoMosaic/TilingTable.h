@@ -0,0 +1,89 @@
+/***
+
+ LegoBitmap - Converts BMP into a Lego Mosaic
+ Copyright (c) 2014 Jeremy Bridon
+
+ Description: Memo table of the cheapest way to cover a
+ w x h rectangle of one color with a given brick catalog.
+ Tilings are guillotine cuts (every cut goes all the way
+ across), found with dynamic programming: a rectangle is
+ a single brick of its exact shape, or the cheaper of its
+ two halves on either side of some cut. Entries are filled
+ on first use and shared by every caller; the table can be
+ saved and loaded, keyed on a hash of the catalog.
+
+***/
+
+#ifndef __TILINGTABLE_H__
+#define __TILINGTABLE_H__
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <stdint.h>
+
+#include "LegoSet.h"
+
+class TilingTable
+{
+public:
+
+    // The definitions are copied; the table is only valid for this catalog
+    TilingTable( const BrickDefinitionList& brickDefinitions );
+
+    // Appends the bricks of the cheapest guillotine tiling of the given rectangle, in one color; false (and nothing added)
+    // if there is none (no 1x1 in the catalog). An empty rectangle adds nothing and returns true
+    bool Tile( const Vec2& origin, const Vec2& size, int colorIndex, BrickList& bricksOut );
+
+    // Text file per catalog; loading a file made for another catalog (or a broken one) changes nothing and returns false
+    bool Load( const char* fileName );
+    bool Save( const char* fileName );
+
+    // Identifies the catalog: shapes and costs, in order
+    uint64_t GetCatalogHash() const { return m_catalogHash; }
+
+    // File name of this catalog's table inside the given directory
+    std::string GetFileName( const char* directory ) const;
+
+    int GetEntryCount();
+
+protected:
+
+    // How a rectangle is tiled: one brick of its shape, or a cut at the given offset across x (vertical) or y (horizontal)
+    enum TilingKind
+    {
+        TilingKind_None = 0,
+        TilingKind_Brick,
+        TilingKind_CutX,
+        TilingKind_CutY,
+    };
+
+    struct Entry
+    {
+        int m_cost;         // -1 if the rectangle can't be tiled
+        int m_choice;       // Definition index, or the cut offset
+        int m_kind;
+    };
+
+    static uint64_t GetKey( int width, int height ) { return ( uint64_t( uint32_t( width ) ) << 32 ) | uint32_t( height ); }
+
+    // Fills in the entry (and every entry it depends on) if it isn't known yet. Works off an explicit stack, so large
+    // rectangles don't recurse deeply, and only takes the lock to look entries up and store them
+    Entry Compute( int width, int height );
+
+    // Lookup and insert under the lock; entries are never removed, and two threads storing the same size store the same value
+    bool FindEntry( uint64_t key, Entry& entryOut );
+    void StoreEntry( uint64_t key, const Entry& entry );
+
+private:
+
+    BrickDefinitionList m_brickDefinitions;
+    uint64_t m_catalogHash;
+
+    std::mutex m_mutex;
+    std::unordered_map< uint64_t, Entry > m_entries;
+};
+
+#endif // __TILINGTABLE_H__
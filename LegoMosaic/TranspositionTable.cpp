@@ -0,0 +1,104 @@
+/***
+
+ LegoBitmap - Converts BMP into a Lego Mosaic
+ Copyright (c) 2014 Jeremy Bridon
+
+***/
+
+#include "TranspositionTable.h"
+
+namespace
+{
+    // Small boards never need more than this, so start here and grow
+    const size_t cInitialEntryCount = 1024;
+}
+
+TranspositionTable::TranspositionTable( size_t maxEntryCount )
+    : m_maxEntryCount( cInitialEntryCount )
+    , m_entryCount( 0 )
+{
+    while( m_maxEntryCount < maxEntryCount )
+    {
+        m_maxEntryCount *= 2;
+    }
+    
+    Entry emptyEntry = { 0, 0 };
+    m_entries.resize( cInitialEntryCount, emptyEntry );
+}
+
+bool TranspositionTable::Lookup( uint64_t key, int& costOut ) const
+{
+    uint64_t storedKey = ToStoredKey( key );
+    size_t mask = m_entries.size() - 1;
+    
+    for( int i = 0; i < cProbeCount; i++ )
+    {
+        const Entry& entry = m_entries[ ( storedKey + i ) & mask ];
+        if( entry.m_key == storedKey )
+        {
+            costOut = entry.m_cost;
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+bool TranspositionTable::Store( uint64_t key, int cost )
+{
+    // Keep at most half full while we're still allowed to grow
+    if( m_entryCount * 2 >= (int)m_entries.size() && m_entries.size() < m_maxEntryCount )
+    {
+        Grow();
+    }
+    
+    uint64_t storedKey = ToStoredKey( key );
+    size_t mask = m_entries.size() - 1;
+    
+    // Find the key, else an empty slot, else the costliest entry in the probe window
+    Entry* target = NULL;
+    for( int i = 0; i < cProbeCount; i++ )
+    {
+        Entry& entry = m_entries[ ( storedKey + i ) & mask ];
+        if( entry.m_key == storedKey )
+        {
+            if( entry.m_cost <= cost )
+            {
+                return false;
+            }
+            entry.m_cost = cost;
+            return true;
+        }
+        
+        if( target == NULL || ( target->m_key != 0 && ( entry.m_key == 0 || entry.m_cost > target->m_cost ) ) )
+        {
+            target = &entry;
+        }
+    }
+    
+    if( target->m_key == 0 )
+    {
+        m_entryCount++;
+    }
+    target->m_key = storedKey;
+    target->m_cost = cost;
+    return true;
+}
+
+void TranspositionTable::Grow()
+{
+    std::vector< Entry > oldEntries;
+    oldEntries.swap( m_entries );
+    
+    Entry emptyEntry = { 0, 0 };
+    m_entries.resize( oldEntries.size() * 2, emptyEntry );
+    m_entryCount = 0;
+    
+    for( size_t i = 0; i < oldEntries.size(); i++ )
+    {
+        if( oldEntries[ i ].m_key != 0 )
+        {
+            Store( oldEntries[ i ].m_key, oldEntries[ i ].m_cost );
+        }
+    }
+}
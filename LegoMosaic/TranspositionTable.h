@@ -0,0 +1,64 @@
+/***
+
+ LegoBitmap - Converts BMP into a Lego Mosaic
+ Copyright (c) 2014 Jeremy Bridon
+
+ Description: Bounded hash table of search states seen so
+ far, keyed on a 64-bit state hash (see Zobrist.h), holding
+ the cheapest cost each state was reached at. Searches use
+ it to drop states that were already reached at the same
+ or a lower cost. It grows as needed up to its maximum
+ size, then replaces its costliest entries; losing an
+ entry only means a state may get searched twice.
+
+***/
+
+#ifndef __TRANSPOSITIONTABLE_H__
+#define __TRANSPOSITIONTABLE_H__
+#pragma once
+
+#include <vector>
+
+#include <stdint.h>
+#include <stddef.h>
+
+class TranspositionTable
+{
+public:
+    
+    // Maximum entry count is rounded up to a power of two
+    TranspositionTable( size_t maxEntryCount );
+    
+    // Returns the cheapest known cost of the state, or false if it isn't in the table
+    bool Lookup( uint64_t key, int& costOut ) const;
+    
+    // Records reaching the state at the given cost; returns false if it was already reached at the same or a lower cost
+    // (a duplicate or dominated state, which doesn't need to be searched again)
+    bool Store( uint64_t key, int cost );
+    
+    int GetEntryCount() const { return m_entryCount; }
+    
+protected:
+    
+    // Doubles the table, re-inserting every entry
+    void Grow();
+    
+private:
+    
+    struct Entry
+    {
+        uint64_t m_key;     // Zero means empty; a real zero key is stored as one
+        int m_cost;
+    };
+    
+    // Slots checked from the home slot of a key before an entry gets replaced
+    static const int cProbeCount = 4;
+    
+    static uint64_t ToStoredKey( uint64_t key ) { return key != 0 ? key : 1; }
+    
+    std::vector< Entry > m_entries;
+    size_t m_maxEntryCount;
+    int m_entryCount;
+};
+
+#endif // __TRANSPOSITIONTABLE_H__
@@ -0,0 +1,48 @@
+/***
+
+ LegoBitmap - Converts BMP into a Lego Mosaic
+ Copyright (c) 2014 Jeremy Bridon
+
+ Description: Zobrist keys for hashing search states. A
+ state's hash is the xor of the keys of everything in it,
+ so adding (or removing) a brick updates the hash with one
+ xor per key, and the order bricks were placed in doesn't
+ matter. Keys are derived on the fly with splitmix64, so
+ there are no tables to size to the board or catalog.
+
+***/
+
+#ifndef __ZOBRIST_H__
+#define __ZOBRIST_H__
+#pragma once
+
+#include <stdint.h>
+
+#include "Vec2.h"
+
+// splitmix64 finalizer; a well-mixed 64-bit value for every input
+inline uint64_t ZobristMix( uint64_t value )
+{
+    value += 0x9E3779B97F4A7C15ULL;
+    value = ( value ^ ( value >> 30 ) ) * 0xBF58476D1CE4E5B9ULL;
+    value = ( value ^ ( value >> 27 ) ) * 0x94D049BB133111EBULL;
+    return value ^ ( value >> 31 );
+}
+
+// Key of one covered peg, for coverage hashes
+inline uint64_t ZobristPegKey( int pegIndex )
+{
+    return ZobristMix( uint64_t( uint32_t( pegIndex ) ) );
+}
+
+// Key of one placed brick: definition, color and position all count
+inline uint64_t ZobristPlacementKey( int definitionId, int colorId, const Vec2& position )
+{
+    uint64_t packed = ( uint64_t( uint16_t( definitionId ) ) << 48 ) | ( uint64_t( uint16_t( colorId ) ) << 32 ) |
+                      ( uint64_t( uint16_t( position.y ) ) << 16 ) | uint64_t( uint16_t( position.x ) );
+    
+    // Different stream than the peg keys
+    return ZobristMix( packed ^ 0xD6E8FEB86659FD93ULL );
+}
+
+#endif // __ZOBRIST_H__
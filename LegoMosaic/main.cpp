@@ -19,40 +19,161 @@
  
  General usage:
  
- ./legomosaic [brick definitions *.txt] [input pictures *.png] <-bruteforce> <-saveprogress> <-nothreading> <-dither>
+ ./legomosaic [brick definitions *.txt] [input pictures *.png] <-bruteforce> <-queue> <-batch n> <-regions> <-exact n> <-astar> <-budget n> <-beam k> <-scanline> <-maxrect> <-partition> <-coarse> <-tilingcache dir> <-timelimit s> <-improve n> <-window w> <-seed s> <-randomties> <-portfolio> <-merge> <-saveprogress> <-nothreading> <-dither>
+
+ -bruteforce: exhaustive depth-first search instead of greedy; tiny images (or, with -regions, small regions) only
+ -queue: greedy search that keeps scored candidates in a heap between bricks; same result as greedy, less work
+ -batch n: greedy commits up to n non-overlapping bricks per pass; faster, slightly lower quality; ignored with -queue
+ -regions: solve each same-color region on its own, in parallel
+ -exact n: exact branch and bound on every region of up to n pegs, greedy on the rest (implies -regions)
+ -astar: best-first search; optimal if it fits the budget, otherwise finished greedily and the gap is printed
+ -budget n: states A* may expand before it gives up on optimality
+ -beam k: beam search keeping the k best partial solutions; -beam 1 is the same as greedy
+ -scanline: single linear-time pass in scan order; lower quality, but fast on very large boards
+ -maxrect: repeatedly cover the largest free same-color rectangle; fast, near-greedy on blocky art
+ -partition: split every color region into the fewest rectangles, then cover each rectangle
+ -coarse: first cover big uniform areas with large bricks, then let the engine fill the rest
+ -tilingcache dir: load and save the rectangle tilings for this brick catalog in dir, reused by later runs
+ -timelimit s: stop searching after s seconds and use the best solution found by then
+ -improve n: after solving, n rounds of ripping out windows of bricks and re-solving them, keeping cheaper ones
+ -window w: window size (w x w pegs) for -improve; by default the largest window that -exact still solves exactly
+ -seed s: seed for everything random; the same seed gives the same result
+ -randomties: greedy breaks rank ties in a seeded random order instead of scan order
+ -portfolio: race several engine configurations in parallel and keep the cheapest; the winner is printed
+ -merge: after solving, merge same-color bricks that exactly tile a cheaper larger brick into it
+ -saveprogress: write out a png after each placed brick
+ -nothreading: evaluate candidates on the calling thread only
+ -dither: dither the image when converting to brick colors
 
 ***/
 
 #include <chrono>
 #include <ctime>
 #include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "LegoMosaic.h"
 
 int main( int argc, const char * argv[] )
 {
-    bool drawProgress = false;
-    bool bruteForce = false;
-    bool noThreading = false;
-    bool dither = false;
+    SolverSettings settings;
     
     // Min args: ./legomosaic
     if( argc < 3 )
     {
-        printf( "./legomosaic [brick definitions *.txt] [input pictures *.png] <-bruteforce> <-saveprogress> <-nothreading> <-dither>\n" );
+        printf( "./legomosaic [brick definitions *.txt] [input pictures *.png] <-bruteforce> <-queue> <-batch n> <-regions> <-exact n> <-astar> <-budget n> <-beam k> <-scanline> <-maxrect> <-partition> <-coarse> <-tilingcache dir> <-timelimit s> <-improve n> <-window w> <-seed s> <-randomties> <-portfolio> <-merge> <-saveprogress> <-nothreading> <-dither>\n" );
     }
     
     // Save def. file name and given png file
     const char* definitionFileName = argv[ 1 ];
     const char* pngFileName = argv[ 2 ];
     
-    // Get any other args
+    // Get any other args; unknown flags are ignored
     for( int i = 3; i < argc; i++ )
     {
-        // Just some minimized code: if( argv[i] == flagString ) flag = true; ignore all else
-        drawProgress |= ( drawProgress == true ) || ( strcmp( argv[ i ], "-saveprogress" ) == 0 );
-        bruteForce |= ( bruteForce == true ) || ( strcmp( argv[ i ], "-bruteforce" ) == 0 );
-        noThreading |= ( bruteForce == true ) || ( strcmp( argv[ i ], "-nothreading" ) == 0 );
-        dither |= ( bruteForce == true ) || ( strcmp( argv[ i ], "-dither" ) == 0 );
+        if( strcmp( argv[ i ], "-saveprogress" ) == 0 )
+        {
+            settings.m_saveProgress = true;
+        }
+        else if( strcmp( argv[ i ], "-bruteforce" ) == 0 )
+        {
+            settings.m_solverType = SolverType_BruteForce;
+        }
+        else if( strcmp( argv[ i ], "-queue" ) == 0 )
+        {
+            settings.m_solverType = SolverType_GreedyQueue;
+        }
+        else if( strcmp( argv[ i ], "-batch" ) == 0 && i + 1 < argc )
+        {
+            settings.m_batchSize = atoi( argv[ ++i ] );
+        }
+        else if( strcmp( argv[ i ], "-exact" ) == 0 && i + 1 < argc )
+        {
+            settings.m_solverType = SolverType_BranchAndBound;
+            settings.m_exactPegLimit = atoi( argv[ ++i ] );
+            settings.m_useRegions = true;
+        }
+        else if( strcmp( argv[ i ], "-astar" ) == 0 )
+        {
+            settings.m_solverType = SolverType_AStar;
+        }
+        else if( strcmp( argv[ i ], "-budget" ) == 0 && i + 1 < argc )
+        {
+            settings.m_searchNodeBudget = atoi( argv[ ++i ] );
+        }
+        else if( strcmp( argv[ i ], "-beam" ) == 0 && i + 1 < argc )
+        {
+            settings.m_solverType = SolverType_Beam;
+            settings.m_beamWidth = atoi( argv[ ++i ] );
+        }
+        else if( strcmp( argv[ i ], "-scanline" ) == 0 )
+        {
+            settings.m_solverType = SolverType_Scanline;
+        }
+        else if( strcmp( argv[ i ], "-maxrect" ) == 0 )
+        {
+            settings.m_solverType = SolverType_MaxRect;
+        }
+        else if( strcmp( argv[ i ], "-partition" ) == 0 )
+        {
+            settings.m_solverType = SolverType_Partition;
+        }
+        else if( strcmp( argv[ i ], "-coarse" ) == 0 )
+        {
+            settings.m_coarseToFine = true;
+        }
+        else if( strcmp( argv[ i ], "-tilingcache" ) == 0 && i + 1 < argc )
+        {
+            settings.m_tilingCacheDirectory = argv[ ++i ];
+        }
+        else if( strcmp( argv[ i ], "-timelimit" ) == 0 && i + 1 < argc )
+        {
+            settings.m_timeLimit = atof( argv[ ++i ] );
+        }
+        else if( strcmp( argv[ i ], "-improve" ) == 0 && i + 1 < argc )
+        {
+            settings.m_improveRounds = atoi( argv[ ++i ] );
+        }
+        else if( strcmp( argv[ i ], "-window" ) == 0 && i + 1 < argc )
+        {
+            settings.m_windowSize = atoi( argv[ ++i ] );
+        }
+        else if( strcmp( argv[ i ], "-seed" ) == 0 && i + 1 < argc )
+        {
+            settings.m_seed = (unsigned int)strtoul( argv[ ++i ], NULL, 10 );
+        }
+        else if( strcmp( argv[ i ], "-randomties" ) == 0 )
+        {
+            settings.m_randomizeTies = true;
+        }
+        else if( strcmp( argv[ i ], "-portfolio" ) == 0 )
+        {
+            settings.m_usePortfolio = true;
+        }
+        else if( strcmp( argv[ i ], "-merge" ) == 0 )
+        {
+            settings.m_mergeBricks = true;
+        }
+        else if( strcmp( argv[ i ], "-regions" ) == 0 )
+        {
+            settings.m_useRegions = true;
+        }
+        else if( strcmp( argv[ i ], "-nothreading" ) == 0 )
+        {
+            settings.m_useThreading = false;
+        }
+        else if( strcmp( argv[ i ], "-dither" ) == 0 )
+        {
+            settings.m_dither = true;
+        }
+    }
+    
+    // The heap engine places one brick per pop, so batches only apply to plain greedy
+    if( settings.m_solverType == SolverType_GreedyQueue && settings.m_batchSize > 1 )
+    {
+        printf( "Warning: -batch is ignored with -queue, which places one brick at a time\n" );
+        settings.m_batchSize = 1;
     }
     
     // Attempt loading
@@ -110,7 +231,7 @@ int main( int argc, const char * argv[] )
     
    	// Load the given image
 	LegoMosaic legoMosaic( brickDefinitions, brickColors );
-	legoMosaic.Solve( pngFileName, drawProgress, bruteForce, !noThreading, dither );
+	bool solved = legoMosaic.Solve( pngFileName, settings );
     
     // Measure time
     end = std::chrono::system_clock::now();
@@ -119,7 +240,10 @@ int main( int argc, const char * argv[] )
     printf( "Total time to compute: %d seconds\n", (int)elapsed_seconds.count() );
     
     // Print the solution set's data
-    legoMosaic.PrintSolution( brickColorNames );
+    if( solved )
+    {
+        legoMosaic.PrintSolution( brickColorNames );
+    }
     
     // Release the strdup'ed strings
     for( int i = 0; i < (int)brickColorNames.size(); i++ )